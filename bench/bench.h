@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+
+// Minimal benchmark helpers: `--name value` flags, timing, keeping results alive, JSON reports
+
+// Value of `--name value` on the command line, default when missing
+inline std::string bench_arg(int argc, char **argv, const char *name, const std::string &default_value) {
+    for (int it = 1; it + 1 < argc; it++) {
+        if (!strcmp(argv[it], name)) {
+            return argv[it + 1];
+        }
+    }
+    return default_value;
+}
+
+inline size_t bench_arg(int argc, char **argv, const char *name, size_t default_value) {
+    auto value = bench_arg(argc, argv, name, std::string());
+    return value.empty() ? default_value : strtoull(value.c_str(), NULL, 0);
+}
+
+inline size_t bench_ram_bytes() {
+    return (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+}
+
+typedef struct BenchTime {
+    double seconds;      // wall clock
+    double cpu_seconds;  // CPU time of the whole process, background threads included
+} BenchTime;
+
+inline double bench_cpu_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Wall and CPU time of fn()
+template<typename Fn>
+BenchTime bench_time(Fn &&fn) {
+    auto cpu_start = bench_cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return {seconds, bench_cpu_seconds() - cpu_start};
+}
+
+// Wall time of fn() in seconds
+template<typename Fn>
+double bench_seconds(Fn &&fn) {
+    return bench_time(fn).seconds;
+}
+
+// Stops the compiler from dropping a computation whose result is unused
+template<class T>
+void bench_keep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+typedef struct BenchResult {
+    std::string name;
+    size_t iterations;  // operations timed
+    BenchTime time;
+    size_t bytes = 0;   // bytes processed, 0 when not meaningful
+} BenchResult;
+
+inline void bench_json_string(FILE *out, const std::string &value) {
+    fputc('"', out);
+    for (auto c : value) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+        }
+        fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// Report in the Google Benchmark JSON shape, so its compare tooling (compare.py) reads it
+inline void bench_write_json(FILE *out, const std::vector<BenchResult> &results) {
+    char date[64];
+    auto now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    fprintf(out, "{\n  \"context\": {\n    \"date\": ");
+    bench_json_string(out, date);
+    fprintf(out, ",\n    \"num_cpus\": %u,\n    \"ram_bytes\": %zu\n  },\n", std::thread::hardware_concurrency(), bench_ram_bytes());
+    fprintf(out, "  \"benchmarks\": [");
+    for (size_t it = 0; it < results.size(); it++) {
+        auto &result = results[it];
+        fprintf(out, "%s\n    {\"name\": ", it ? "," : "");
+        bench_json_string(out, result.name);
+        fprintf(out, ", \"run_name\": ");
+        bench_json_string(out, result.name);
+        auto iterations = std::max<size_t>(result.iterations, 1);
+        auto seconds = result.time.seconds;
+        fprintf(
+            out, ", \"run_type\": \"iteration\", \"iterations\": %zu, \"real_time\": %.3f, \"cpu_time\": %.3f"
+            ", \"time_unit\": \"ns\", \"items_per_second\": %.1f",
+            iterations, seconds * 1e9 / iterations, result.time.cpu_seconds * 1e9 / iterations, iterations / seconds
+        );
+        if (result.bytes) {
+            fprintf(out, ", \"bytes_per_second\": %.1f", result.bytes / seconds);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,132 @@
+#include <storage/block.h>
+#include <storage/idx_sort_layout.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+
+// Point lookups (find_key_range(q, q)) per static index layout over a sweep of index sizes:
+//   idx_layout_bench [--key i64|i32] [--min-bytes 16384] [--max-bytes <10x RAM>]
+//                    [--queries 1000000] [--file idx_layout_bench.dat]
+// Every size is 4x the previous one. Indexes live in a mapped file, so sizes past RAM page
+// in from disk like a real index would. Key i is 2i, so half of the queries miss.
+
+struct BenchConfig {
+    size_t queries;
+    std::string file;
+};
+
+template<class T>
+static void report(const char *layout, size_t n, double seconds, size_t nqueries, size_t errors) {
+    printf("%s\t%zu\t%zu\t%.1f\t%zu\n", layout, n * sizeof(T), n, seconds * 1e9 / nqueries, errors);
+    fflush(stdout);
+}
+
+// Expected [start, end) of a point query over keys 0, 2, 4, ...
+template<class T>
+static bool check_range(T query, size_t start, size_t end) {
+    return start == (size_t(query) + 1) / 2 && end == size_t(query) / 2 + 1;
+}
+
+template<class T, class Layout>
+static void bench_layout(const char *name, const Layout &layout, size_t n, const std::vector<T> &queries, const BenchConfig &config) {
+    BlockStorage<T> storage(config.file.c_str(), false, layout.size());
+    layout.build(storage.mapped(), [](size_t it) { return T(2 * it); });
+    const T *data = storage.mapped();
+
+    size_t errors = 0;
+    size_t checksum = 0;
+    auto seconds = bench_seconds([&]() {
+        for (auto query : queries) {
+            auto [start, end] = layout.find_key_range(data, query, query);
+            errors += !check_range(query, start, end);
+            checksum += start;
+        }
+    });
+    bench_keep(checksum);
+    report<T>(name, n, seconds, queries.size(), errors);
+}
+
+template<class T>
+static void bench_staged_batch(const char *name, const StagedLayout &layout, size_t n, const std::vector<T> &queries, const BenchConfig &config) {
+    BlockStorage<T> storage(config.file.c_str(), false, layout.size());
+    layout.build(storage.mapped(), [](size_t it) { return T(2 * it); });
+    std::span<const T> keys(storage.mapped(), n);
+
+    std::vector<size_t> starts(queries.size()), ends(queries.size());
+    auto seconds = bench_seconds([&]() {
+        find_key_range_batch<T>(
+            keys, layout.stage_ends, layout.stage_size_steps, layout.nstages,
+            queries, queries, starts.data(), ends.data()
+        );
+    });
+    size_t errors = 0;
+    for (size_t it = 0; it < queries.size(); it++) {
+        errors += !check_range(queries[it], starts[it], ends[it]);
+    }
+    report<T>(name, n, seconds, queries.size(), errors);
+}
+
+template<class T>
+static void bench_size(size_t n, const BenchConfig &config) {
+    std::mt19937_64 rng(n);
+    std::vector<T> queries(config.queries);
+    for (auto &query : queries) {
+        query = T(rng() % (2 * n));
+    }
+
+    bench_layout<T>("sorted", StagedLayout(n, 1, n), n, queries, config);
+    bench_layout<T>("staged-16", StagedLayout(n, 16), n, queries, config);
+    bench_layout<T>("staged-64", StagedLayout(n, 64), n, queries, config);
+    bench_staged_batch<T>("staged-16-batch", StagedLayout(n, 16), n, queries, config);
+    bench_layout<T>("eytzinger", EytzingerLayout(n), n, queries, config);
+    bench_layout<T>("stree", StreeLayout(n, idx_line_items<T>()), n, queries, config);
+}
+
+template<class T>
+static void bench_sweep(size_t min_bytes, size_t max_bytes, const BenchConfig &config) {
+    printf("layout\tbytes\tkeys\tns_per_lookup\terrors\n");
+    for (auto bytes = min_bytes; bytes <= max_bytes; bytes *= 4) {
+        auto n = bytes / sizeof(T);
+        // Keys are 2i, they have to fit the key type
+        if (2 * n > size_t(std::numeric_limits<T>::max())) {
+            fprintf(stderr, "%zu keys do not fit the key type, stopping\n", n);
+            break;
+        }
+        bench_size<T>(n, config);
+    }
+}
+
+int main(int argc, char **argv) {
+    auto key = bench_arg(argc, argv, "--key", std::string("i64"));
+    auto min_bytes = std::max<size_t>(bench_arg(argc, argv, "--min-bytes", size_t(16 << 10)), 64);
+    auto max_bytes = bench_arg(argc, argv, "--max-bytes", 10 * bench_ram_bytes());
+    BenchConfig config;
+    config.queries = std::max<size_t>(bench_arg(argc, argv, "--queries", size_t(1000000)), 1);
+    config.file = bench_arg(argc, argv, "--file", std::string("idx_layout_bench.dat"));
+
+    fprintf(stderr, "ram: %zu bytes, sweep %zu - %zu bytes\n", bench_ram_bytes(), min_bytes, max_bytes);
+    try {
+        if (key == "i32") {
+            bench_sweep<int32_t>(min_bytes, max_bytes, config);
+        } else if (key == "i64") {
+            bench_sweep<int64_t>(min_bytes, max_bytes, config);
+        } else {
+            fprintf(stderr, "unknown key type `%s`, use i32 or i64\n", key.c_str());
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        unlink(config.file.c_str());
+        return 1;
+    }
+    unlink(config.file.c_str());
+    return 0;
+}
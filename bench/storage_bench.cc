@@ -0,0 +1,377 @@
+#include <storage/block.h>
+#include <storage/hash.h>
+#include <storage/idx_hash_dynamic.h>
+#include <storage/idx_hash_linear.h>
+#include <storage/idx_sort_dynamic.h>
+#include <storage/idx_sort_layout.h>
+#include <storage/idx_sort_string.h>
+#include <utils/sys/err.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+
+#include "bench.h"
+
+
+// Storage micro benchmarks with a JSON report (Google Benchmark format):
+//   storage_bench [--min-size 4096] [--max-size 4194304] [--repetitions 3]
+//                 [--filter <substring>] [--dir storage_bench.tmp] [--out <file>]
+// Sizes are item counts (bytes for BlockStorage), swept by 16x. Every benchmark is run
+// repetitions times on fresh state and the fastest run is reported; seeds are fixed.
+// Read benchmarks write their file first, the _cold ones drop it from the page cache.
+
+typedef struct BenchCase {
+    std::string name;
+    std::function<BenchResult(size_t size)> run;
+} BenchCase;
+
+static std::string bench_dir;
+
+static std::string bench_path(const char *name) {
+    return bench_dir + "/" + name;
+}
+
+static std::vector<uint64_t> random_keys(size_t n, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<uint64_t> keys(n);
+    for (auto &key : keys) {
+        key = rng();
+    }
+    return keys;
+}
+
+static std::vector<size_t> random_offsets(size_t n, size_t limit, size_t align, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<size_t> offsets(n);
+    for (auto &offset : offsets) {
+        offset = rng() % (limit / align) * align;
+    }
+    return offsets;
+}
+
+constexpr static size_t SEQ_CHUNK = 64 << 10;
+constexpr static size_t RAND_CHUNK = 4 << 10;
+
+// Writes bytes of data to path before a read benchmark, so reads hit real blocks instead of
+// the holes of a fresh sparse file; cold drops the file from the page cache afterwards
+static void fill_file(const std::string &path, size_t bytes, bool cold) {
+    unique_fd fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!fd.valid()) {
+        throw_sys_error("create " + path);
+    }
+    std::vector<byte> chunk(SEQ_CHUNK, 0x5a);
+    for (size_t offset = 0; offset < bytes; offset += SEQ_CHUNK) {
+        auto count = std::min(SEQ_CHUNK, bytes - offset);
+        if (pwrite(fd, chunk.data(), count, offset) != (ssize_t)count) {
+            throw_sys_error("write " + path);
+        }
+    }
+    if (fsync(fd) == -1) {
+        throw_sys_error("fsync " + path);
+    }
+    if (cold && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) {
+        throw std::runtime_error("Cannot drop `" + path + "` from the page cache.");
+    }
+}
+
+static BenchResult block_seq_write(size_t bytes) {
+    auto path = bench_path("block");
+    BlockStorage<byte> storage(path.c_str(), false, bytes);
+    std::vector<byte> chunk(SEQ_CHUNK, 0x5a);
+    auto elapsed = bench_time([&]() {
+        for (size_t offset = 0; offset < bytes; offset += SEQ_CHUNK) {
+            storage.write(offset, chunk.data(), SEQ_CHUNK);
+        }
+    });
+    return {"", (bytes + SEQ_CHUNK - 1) / SEQ_CHUNK, elapsed, bytes};
+}
+
+static BenchResult block_seq_read(size_t bytes, bool cold) {
+    auto path = bench_path("block");
+    fill_file(path, bytes, cold);
+    BlockStorage<byte> storage(path.c_str(), false, bytes);
+    storage.advise(cold ? AccessMode::SEQUENTIAL : AccessMode::WILL_NEED);
+    std::vector<byte> chunk(SEQ_CHUNK);
+    size_t total = 0;
+    auto elapsed = bench_time([&]() {
+        for (size_t offset = 0; offset < bytes; offset += SEQ_CHUNK) {
+            total += storage.read(offset, chunk.data(), SEQ_CHUNK);
+        }
+        bench_keep(chunk[0]);
+    });
+    return {"", (bytes + SEQ_CHUNK - 1) / SEQ_CHUNK, elapsed, total};
+}
+
+static BenchResult block_rand_read(size_t bytes, bool cold) {
+    auto path = bench_path("block");
+    fill_file(path, std::max(bytes, RAND_CHUNK), cold);
+    BlockStorage<byte> storage(path.c_str(), false, std::max(bytes, RAND_CHUNK));
+    auto offsets = random_offsets(std::max<size_t>(bytes / RAND_CHUNK, 1024), storage.size(), RAND_CHUNK, 1);
+    std::vector<byte> chunk(RAND_CHUNK);
+    auto elapsed = bench_time([&]() {
+        for (auto offset : offsets) {
+            storage.read(offset, chunk.data(), RAND_CHUNK);
+            bench_keep(chunk[0]);
+        }
+    });
+    return {"", offsets.size(), elapsed, offsets.size() * RAND_CHUNK};
+}
+
+static BenchResult block_rand_write(size_t bytes) {
+    auto path = bench_path("block");
+    BlockStorage<byte> storage(path.c_str(), false, std::max(bytes, RAND_CHUNK));
+    auto offsets = random_offsets(std::max<size_t>(bytes / RAND_CHUNK, 1024), storage.size(), RAND_CHUNK, 2);
+    std::vector<byte> chunk(RAND_CHUNK, 0xa5);
+    auto elapsed = bench_time([&]() {
+        for (auto offset : offsets) {
+            storage.write(offset, chunk.data(), RAND_CHUNK);
+        }
+    });
+    return {"", offsets.size(), elapsed, offsets.size() * RAND_CHUNK};
+}
+
+static BenchResult hash_fast_u64(size_t n) {
+    auto keys = random_keys(n, 3);
+    hash_t sum = 0;
+    auto elapsed = bench_time([&]() {
+        for (auto key : keys) {
+            sum += hash_fast(1 << 20, key);
+        }
+    });
+    bench_keep(sum);
+    return {"", n, elapsed, n * sizeof(uint64_t)};
+}
+
+// 64 byte records, a typical object id / small key size
+static BenchResult hash_fast_bytes64(size_t n) {
+    constexpr size_t RECORD = 64;
+    auto words = random_keys(n * RECORD / sizeof(uint64_t), 4);
+    auto data = reinterpret_cast<const unsigned char*>(words.data());
+    hash_t sum = 0;
+    auto elapsed = bench_time([&]() {
+        for (size_t it = 0; it < n; it++) {
+            sum += hash_fast(1 << 20, data + it * RECORD, RECORD);
+        }
+    });
+    bench_keep(sum);
+    return {"", n, elapsed, n * RECORD};
+}
+
+static BenchResult hash_index_insert(size_t n) {
+    auto path = bench_path("hash_index");
+    auto keys = random_keys(n, 5);
+    HashIndex<uint64_t, uint64_t> index(path.c_str(), n);
+    auto elapsed = bench_time([&]() {
+        for (auto key : keys) {
+            index.insert(key, key);
+        }
+    });
+    return {"", n, elapsed};
+}
+
+// Probes are the inserted keys when hit, fresh random keys (misses) otherwise
+static BenchResult hash_index_find(size_t n, bool hit) {
+    auto path = bench_path("hash_index");
+    auto keys = random_keys(n, 5);
+    HashIndex<uint64_t, uint64_t> index(path.c_str(), n);
+    for (auto key : keys) {
+        index.insert(key, key);
+    }
+    auto probes = hit ? keys : random_keys(n, 6);
+    size_t found = 0;
+    auto elapsed = bench_time([&]() {
+        for (auto key : probes) {
+            found += index.find(key);
+        }
+    });
+    bench_keep(found);
+    return {"", n, elapsed};
+}
+
+static BenchResult linear_hash_insert(size_t n) {
+    auto path = bench_path("linear_hash");
+    auto keys = random_keys(n, 7);
+    LinearHashIndex<uint64_t, uint64_t> index(path.c_str(), false);
+    auto elapsed = bench_time([&]() {
+        for (auto key : keys) {
+            index.insert(key, key);
+        }
+    });
+    return {"", n, elapsed};
+}
+
+static BenchResult linear_hash_find(size_t n) {
+    auto path = bench_path("linear_hash");
+    auto keys = random_keys(n, 7);
+    LinearHashIndex<uint64_t, uint64_t> index(path.c_str(), false);
+    for (auto key : keys) {
+        index.insert(key, key);
+    }
+    size_t found = 0;
+    auto elapsed = bench_time([&]() {
+        for (auto key : keys) {
+            found += index.find(key);
+        }
+    });
+    bench_keep(found);
+    return {"", n, elapsed};
+}
+
+static BenchResult tree_insert(size_t n) {
+    auto path = bench_path("tree");
+    auto keys = random_keys(n, 8);
+    OrderStatTree<uint64_t> tree(path.c_str(), false);
+    auto elapsed = bench_time([&]() {
+        for (auto key : keys) {
+            tree.insert(key);
+        }
+    });
+    return {"", n, elapsed};
+}
+
+static BenchResult tree_rank(size_t n) {
+    auto path = bench_path("tree");
+    auto keys = random_keys(n, 8);
+    OrderStatTree<uint64_t> tree(path.c_str(), false);
+    for (auto key : keys) {
+        tree.insert(key);
+    }
+    auto probes = random_keys(n, 9);
+    size_t sum = 0;
+    auto elapsed = bench_time([&]() {
+        for (auto key : probes) {
+            sum += tree.rank(key);
+        }
+    });
+    bench_keep(sum);
+    return {"", n, elapsed};
+}
+
+// Static index over keys 0, 2, 4, ...; range queries cover ~64 keys
+static BenchResult static_index_query(size_t n, uint64_t width) {
+    auto path = bench_path("static_index");
+    StagedLayout layout(n, 16);
+    BlockStorage<uint64_t> storage(path.c_str(), false, layout.size());
+    layout.build(storage.mapped(), [](size_t it) { return uint64_t(2 * it); });
+    const uint64_t *data = storage.mapped();
+
+    auto probes = random_keys(std::max<size_t>(n, 1 << 16), 10);
+    for (auto &probe : probes) {
+        probe %= 2 * n;
+    }
+    size_t sum = 0;
+    auto elapsed = bench_time([&]() {
+        for (auto probe : probes) {
+            auto [start, end] = layout.find_key_range(data, probe, probe + width);
+            sum += end - start;
+        }
+    });
+    bench_keep(sum);
+    return {"", probes.size(), elapsed};
+}
+
+// Lookups of present keys in a string index over hex ids behind key_prefix; a long shared
+// prefix like `objects/<bucket>/` must not make every block prefix tie
+static BenchResult string_index_lookup(size_t n, const std::string &key_prefix) {
+    auto path = bench_path("string_index");
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (auto id : random_keys(n, 11)) {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)id);
+        keys.push_back(key_prefix + hex);
+    }
+    build_string_index(path.c_str(), std::vector<std::string_view>(keys.begin(), keys.end()), 16, 0);
+    StringSortIndex index(path.c_str());
+
+    auto probes = random_offsets(std::max<size_t>(n, 1 << 16), n, 1, 12);
+    size_t sum = 0;
+    auto elapsed = bench_time([&]() {
+        for (auto probe : probes) {
+            sum += index.lower_bound(keys[probe]);
+        }
+    });
+    bench_keep(sum);
+    return {"", probes.size(), elapsed};
+}
+
+static std::vector<BenchCase> bench_cases() {
+    return {
+        {"block_storage/seq_write", block_seq_write},
+        {"block_storage/seq_read", [](size_t n) { return block_seq_read(n, false); }},
+        {"block_storage/seq_read_cold", [](size_t n) { return block_seq_read(n, true); }},
+        {"block_storage/rand_read_4k", [](size_t n) { return block_rand_read(n, false); }},
+        {"block_storage/rand_read_4k_cold", [](size_t n) { return block_rand_read(n, true); }},
+        {"block_storage/rand_write_4k", block_rand_write},
+        {"hash_fast/u64", hash_fast_u64},
+        {"hash_fast/bytes64", hash_fast_bytes64},
+        {"hash_index/insert", hash_index_insert},
+        {"hash_index/find_hit", [](size_t n) { return hash_index_find(n, true); }},
+        {"hash_index/find_miss", [](size_t n) { return hash_index_find(n, false); }},
+        {"linear_hash/insert", linear_hash_insert},
+        {"linear_hash/find", linear_hash_find},
+        {"order_stat_tree/insert", tree_insert},
+        {"order_stat_tree/rank", tree_rank},
+        {"static_index/point", [](size_t n) { return static_index_query(n, 0); }},
+        {"static_index/range64", [](size_t n) { return static_index_query(n, 128); }},
+        {"string_index/lookup", [](size_t n) { return string_index_lookup(n, ""); }},
+        {"string_index/lookup_shared_prefix", [](size_t n) { return string_index_lookup(n, "objects/bucket-000000000001/"); }},
+    };
+}
+
+int main(int argc, char **argv) {
+    auto min_size = std::max<size_t>(bench_arg(argc, argv, "--min-size", size_t(1 << 12)), 1);
+    auto max_size = bench_arg(argc, argv, "--max-size", size_t(1 << 22));
+    auto repetitions = std::max<size_t>(bench_arg(argc, argv, "--repetitions", size_t(3)), 1);
+    auto filter = bench_arg(argc, argv, "--filter", std::string());
+    auto out_path = bench_arg(argc, argv, "--out", std::string());
+    bench_dir = bench_arg(argc, argv, "--dir", std::string("storage_bench.tmp"));
+
+    std::vector<BenchResult> results;
+    try {
+        for (auto &bench : bench_cases()) {
+            if (bench.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            for (auto size = min_size; size <= max_size; size *= 16) {
+                BenchResult best;
+                for (size_t it = 0; it < repetitions; it++) {
+                    // Fresh files for every run
+                    std::filesystem::remove_all(bench_dir);
+                    std::filesystem::create_directories(bench_dir);
+                    auto result = bench.run(size);
+                    if (!it || result.time.seconds < best.time.seconds) {
+                        best = result;
+                    }
+                }
+                best.name = bench.name + "/" + std::to_string(size);
+                fprintf(stderr, "%s: %.1f ns/op\n", best.name.c_str(), best.time.seconds * 1e9 / std::max<size_t>(best.iterations, 1));
+                results.push_back(best);
+            }
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        std::filesystem::remove_all(bench_dir);
+        return 1;
+    }
+    std::filesystem::remove_all(bench_dir);
+
+    auto out = out_path.empty() ? stdout : fopen(out_path.c_str(), "w");
+    if (!out) {
+        perror(out_path.c_str());
+        return 1;
+    }
+    bench_write_json(out, results);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
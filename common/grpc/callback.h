@@ -133,7 +133,13 @@ class GRPCBasicHandler : public GRPCHandler {
 };
 
 
-template<class Tderived, class Tservice, class Trequest, class Tresult>
+/// Streaming RPC handler. Tstream picks the direction: bidirectional by default,
+/// `grpc::ServerAsyncWriter<Tresult>` for server streaming, `grpc::ServerAsyncReader<Tresult, Trequest>`
+/// for client streaming (read / write helpers only compile for streams that have them).
+template<
+    class Tderived, class Tservice, class Trequest, class Tresult,
+    class Tstream = grpc::ServerAsyncReaderWriter<Tresult, Trequest>
+>
 class GRPCStreamHandler : public GRPCHandler {
     protected:
     grpc::ServerContext ctx;
@@ -146,7 +152,7 @@ class GRPCStreamHandler : public GRPCHandler {
     Tservice* service = nullptr;
     Trequest request;
     Tresult response;
-    grpc::ServerAsyncReaderWriter<Tresult, Trequest> stream;
+    Tstream stream;
 
     /// Optional self-ownership when not using `shared_ptr` (see `MessageStreamHandler`).
     std::unique_ptr<Tderived> self_;
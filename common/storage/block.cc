@@ -1,6 +1,11 @@
 #include "block.h"
-#include "unique_fd.h"
+
+#include <algorithm>
+#include <cerrno>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
 
 
 typedef unsigned char byte;
@@ -17,16 +22,21 @@ int get_prot_flags(bool readonly) {
     return readonly ? PROT_READ : PROT_READ | PROT_WRITE;
 }
 
-size_t read_data(
-    const void *data, size_t elem_size, size_t n,
-    void *out_data, size_t offset, size_t data_count
-) {
+size_t clamp_data_count(size_t offset, size_t data_count, size_t n) {
     if (offset > n) {
         return 0;
     }
     if (offset + data_count > n) {
         data_count = n - offset;
     }
+    return data_count;
+}
+
+size_t read_data(
+    const void *data, size_t elem_size, size_t n,
+    void *out_data, size_t offset, size_t data_count
+) {
+    data_count = clamp_data_count(offset, data_count, n);
     if (data_count == 0) {
         return 0;
     }
@@ -38,25 +48,20 @@ size_t write_data(
     const void *in_data, size_t offset, size_t data_count,
     void *data, size_t elem_size, size_t n, bool readonly
 ) {
-    if (offset > n) {
-        return 0;
-    }
-    if (offset + data_count > n) {
-        data_count = n - offset;
-    }
+    data_count = clamp_data_count(offset, data_count, n);
     if (data_count == 0) {
         return 0;
     }
     if (readonly) {
         throw std::runtime_error("Cannot write to a readonly BlockStorage instance.");
     }
-    std::copy((byte*)in_data, ((byte*)in_data) + data_count * elem_size, data + offset * elem_size);
+    std::copy((byte*)in_data, ((byte*)in_data) + data_count * elem_size, ((byte*)data) + offset * elem_size);
     return data_count;
 }
 
 unique_fd init_data_file(const char *fname, bool readonly, size_t size) {
     unique_fd fd = open(fname, get_open_flags(readonly, true), S_IRUSR | S_IWUSR);
-    if (fd.valid()) {
+    if (!fd.valid()) {
         throw_sys_error("open or create file `" + std::string(fname) + "`");
     }
 
@@ -64,11 +69,12 @@ unique_fd init_data_file(const char *fname, bool readonly, size_t size) {
     if (ftruncate(fd, size) == -1) {
         throw_sys_error("ftruncate file `" + std::string(fname) + "`");
     }
+    return fd;
 }
 
 unique_fd open_data_file(const char *fname, bool readonly, size_t *size) {
     unique_fd fd = open(fname, get_open_flags(readonly, false));
-    if (fd.valid()) {
+    if (!fd.valid()) {
         throw_sys_error("open file `" + std::string(fname) + "`");
     }
 
@@ -84,17 +90,202 @@ unique_fd open_data_file(const char *fname, bool readonly, size_t *size) {
     return fd;
 }
 
-void *mmap_data(int fd, const char *fname, bool readonly, size_t size) {
+constexpr static size_t THP_SIZE = 2 << 20;
+
+static size_t get_huge_page_size() {
+    static const size_t size = [] {
+        size_t kb = 2048;
+        FILE *meminfo = fopen("/proc/meminfo", "r");
+        if (meminfo) {
+            char line[128];
+            while (fgets(line, sizeof(line), meminfo)) {
+                if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) {
+                    break;
+                }
+            }
+            fclose(meminfo);
+        }
+        return kb << 10;
+    }();
+    return size;
+}
+
+static size_t get_map_length(size_t size, const MapOptions &options) {
+    if (options.hugetlb) {
+        auto page = get_huge_page_size();
+        return (size + page - 1) / page * page;
+    }
+    return size;
+}
+
+// Reserve an address range aligned to `align` so the kernel can back it with PMD mappings
+static void *reserve_aligned(size_t size, size_t align) {
+    auto base = mmap(NULL, size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    auto start = (uintptr_t)base;
+    auto aligned = (start + align - 1) & ~(uintptr_t)(align - 1);
+    if (aligned > start) {
+        munmap(base, aligned - start);
+    }
+    munmap((void*)(aligned + size), start + align - aligned);
+    return (void*)aligned;
+}
+
+void *mmap_data(int fd, const char *fname, bool readonly, size_t size, const MapOptions &options) {
     if (size == 0) {
         // Empty file, nothing to mmap
         return NULL;
     }
 
+    int flags = MAP_SHARED;
+    if (options.populate) {
+        flags |= MAP_POPULATE;
+    }
+    void *hint = NULL;
+    if (options.thp && size >= THP_SIZE) {
+        hint = reserve_aligned(size, THP_SIZE);
+        if (hint) {
+            flags |= MAP_FIXED;
+        }
+    }
+
     // Memory map the file
-    void *data = mmap(NULL, size, get_prot_flags(readonly), MAP_SHARED, fd, 0);
+    void *data = mmap(hint, get_map_length(size, options), get_prot_flags(readonly), flags, fd, 0);
     if (data == MAP_FAILED) {
+        if (hint) {
+            munmap(hint, size);
+        }
         throw_sys_error("mmap file `" + std::string(fname) + "`");
     }
 
+    if (options.thp && madvise(data, size, MADV_HUGEPAGE) == -1) {
+        show_sys_error("madvise hugepage for `" + std::string(fname) + "`");
+    }
+
     return data;
 }
+
+void unmap_data(void *data, size_t size, const MapOptions &options) {
+    if (munmap(data, get_map_length(size, options)) == -1) {
+        show_sys_error("munmap");
+    }
+}
+
+void sync_data(void *data, size_t size, bool async) {
+    if (msync(data, size, async ? MS_ASYNC : MS_SYNC) == -1) {
+        throw_sys_error("msync mapped data");
+    }
+}
+
+HugePageStats get_huge_page_stats(const void *data) {
+    HugePageStats stats;
+    if (!data) {
+        return stats;
+    }
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (!smaps) {
+        show_sys_error("open /proc/self/smaps");
+        return stats;
+    }
+
+    char line[256];
+    bool found = false;
+    while (fgets(line, sizeof(line), smaps)) {
+        uintptr_t start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            // Header line of the next mapping
+            if (found) {
+                break;
+            }
+            found = start == (uintptr_t)data;
+            if (found) {
+                stats.mapped_bytes = end - start;
+            }
+            continue;
+        }
+        if (!found) {
+            continue;
+        }
+        size_t kb;
+        char key[64];
+        if (sscanf(line, "%63[^:]: %zu kB", key, &kb) != 2) {
+            continue;
+        }
+        std::string name(key);
+        if (name == "Rss") {
+            stats.resident_bytes = kb << 10;
+        } else if (
+            name == "AnonHugePages" || name == "ShmemPmdMapped" || name == "FilePmdMapped"
+            || name == "Shared_Hugetlb" || name == "Private_Hugetlb"
+        ) {
+            stats.huge_bytes += kb << 10;
+        }
+    }
+    fclose(smaps);
+    return stats;
+}
+
+static void madvise_range(void *data, size_t offset, size_t size, int advice) {
+    // madvise wants a page aligned start
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    auto start = offset & ~(page_size - 1);
+    if (madvise(((byte*)data) + start, size + (offset - start), advice) == -1) {
+        show_sys_error("madvise mapped range");
+    }
+}
+
+static void fadvise_range(int fd, size_t offset, size_t size, int advice) {
+    // posix_fadvise returns the error instead of setting errno
+    int err = posix_fadvise(fd, offset, size, advice);
+    if (err) {
+        errno = err;
+        show_sys_error("posix_fadvise file range");
+    }
+}
+
+void advise_data(int fd, void *data, size_t offset, size_t size, AccessMode mode) {
+    int madv, fadv;
+    switch (mode) {
+        case AccessMode::SEQUENTIAL:
+            madv = MADV_SEQUENTIAL;
+            fadv = POSIX_FADV_SEQUENTIAL;  // doubles the readahead window
+            break;
+        case AccessMode::RANDOM:
+            madv = MADV_RANDOM;
+            fadv = POSIX_FADV_RANDOM;
+            break;
+        case AccessMode::WILL_NEED:
+            madv = MADV_WILLNEED;
+            fadv = POSIX_FADV_WILLNEED;
+            break;
+        case AccessMode::DONT_NEED:
+            madv = MADV_DONTNEED;
+            fadv = POSIX_FADV_DONTNEED;
+            break;
+        case AccessMode::HUGEPAGE:
+            madv = MADV_HUGEPAGE;
+            fadv = -1;
+            break;
+        default:
+            madv = MADV_NORMAL;
+            fadv = POSIX_FADV_NORMAL;
+            break;
+    }
+    if (data) {
+        madvise_range(data, offset, size, madv);
+    }
+    if (fd != -1 && fadv != -1) {
+        fadvise_range(fd, offset, size, fadv);
+    }
+}
+
+void prefetch_data(int fd, void *data, size_t offset, size_t size) {
+    if (data) {
+        // Kicks off page cache readahead for the mapped range without faulting it in
+        madvise_range(data, offset, size, MADV_WILLNEED);
+    } else if (fd != -1) {
+        fadvise_range(fd, offset, size, POSIX_FADV_WILLNEED);
+    }
+}
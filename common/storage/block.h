@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <span>
 #include <stdexcept>
+#include <string>
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -9,13 +12,35 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
-#include "unique_fd.h"
+#include <utils/unique_fd.h>
 
 
 typedef unsigned char byte;
 
+enum class AccessMode {
+    NORMAL,
+    SEQUENTIAL,
+    RANDOM,
+    WILL_NEED,
+    DONT_NEED,
+    HUGEPAGE
+};
+
+typedef struct MapOptions {
+    bool populate = false;  // prefault the whole mapping at open (MAP_POPULATE)
+    bool thp = false;       // 2 MiB aligned mapping + MADV_HUGEPAGE, needs file THP support on the fs
+    bool hugetlb = false;   // file on hugetlbfs, size must be a multiple of the huge page size
+} MapOptions;
+
+typedef struct HugePageStats {
+    size_t mapped_bytes = 0;
+    size_t resident_bytes = 0;
+    size_t huge_bytes = 0;    // resident in huge pages (THP or hugetlb)
+} HugePageStats;
+
 int get_open_flags(bool readonly, bool create);
 int get_prot_flags(bool readonly);
+size_t clamp_data_count(size_t offset, size_t data_count, size_t n);
 size_t read_data(
     const void *data, size_t elem_size, size_t n,
     void *out_data, size_t offset, size_t data_count
@@ -26,22 +51,103 @@ size_t write_data(
 );
 unique_fd init_data_file(const char *fname, bool readonly, size_t size);
 unique_fd open_data_file(const char *fname, bool readonly, size_t *size = NULL);
-void *mmap_data(int fd, const char *fname, bool readonly, size_t size);
+void *mmap_data(int fd, const char *fname, bool readonly, size_t size, const MapOptions &options = {});
+void unmap_data(void *data, size_t size, const MapOptions &options = {});
+void sync_data(void *data, size_t size, bool async);
+HugePageStats get_huge_page_stats(const void *data);
+// Hints are best effort - failures are reported, not thrown
+void advise_data(int fd, void *data, size_t offset, size_t size, AccessMode mode);
+void prefetch_data(int fd, void *data, size_t offset, size_t size);
+
+// Borrowed, zero-copy view into a mapping. While any view is alive the owning
+// storage refuses reset(); views must not outlive the storage object itself.
+template<class T>
+class BlockView {
+    std::atomic<int> *pins = NULL;
+    std::span<const T> items;
+
+    public:
+    BlockView() {}
+    BlockView(std::atomic<int> *pins, std::span<const T> items)
+        : pins(pins), items(items) {
+        if (pins) {
+            pins->fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    BlockView(const BlockView &other) : BlockView(other.pins, other.items) {}
+    BlockView(BlockView &&other) : pins(other.pins), items(other.items) {
+        other.pins = NULL;
+        other.items = {};
+    }
+    BlockView &operator=(BlockView other) {
+        std::swap(pins, other.pins);
+        std::swap(items, other.items);
+        return *this;
+    }
+
+    void release() {
+        if (pins) {
+            pins->fetch_sub(1, std::memory_order_release);
+            pins = NULL;
+        }
+        items = {};
+    }
+
+    std::span<const T> span() const {
+        return items;
+    }
+    operator std::span<const T>() const {
+        return items;
+    }
+    const T *data() const {
+        return items.data();
+    }
+    size_t size() const {
+        return items.size();
+    }
+    bool empty() const {
+        return items.empty();
+    }
+    const T &operator[](size_t idx) const {
+        return items[idx];
+    }
+    auto begin() const {
+        return items.begin();
+    }
+    auto end() const {
+        return items.end();
+    }
+
+    ~BlockView() {
+        release();
+    }
+};
 
 template<class T = byte>
 class BlockStorage {
     unique_fd fd;
-    T *data;
-    std::size_t n;
+    T *data = NULL;
+    std::size_t n = 0;
     bool readonly;
+    MapOptions options;
+    std::atomic<int> pins = 0;
+
+    void unmap() {
+        if (data && data != MAP_FAILED) {
+            unmap_data(data, get_sizeof(), options);
+        }
+        data = NULL;
+        n = 0;
+        fd.reset();
+    }
 
     public:
     size_t get_sizeof() const {
         return n * sizeof(T);
     }
 
-    BlockStorage(const char *fname, bool readonly = true)
-        : readonly(readonly) {
+    BlockStorage(const char *fname, bool readonly = true, MapOptions options = {})
+        : readonly(readonly), options(options) {
         size_t size;
         fd = open_data_file(fname, readonly, &size);
 
@@ -51,13 +157,67 @@ class BlockStorage {
         }
         n = size / sizeof(T);
 
-        data = static_cast<T*>(mmap_data(fd, fname, readonly, get_sizeof()));
+        data = static_cast<T*>(mmap_data(fd, fname, readonly, get_sizeof(), options));
     }
 
-    BlockStorage(const char *fname, bool readonly, size_t n)
-        : readonly(readonly), n(n) {
+    BlockStorage(const char *fname, bool readonly, size_t n, MapOptions options = {})
+        : n(n), readonly(readonly), options(options) {
         fd = init_data_file(fname, readonly, get_sizeof());
-        data = static_cast<T*>(mmap_data(fd, fname, readonly, get_sizeof()));
+        data = static_cast<T*>(mmap_data(fd, fname, readonly, get_sizeof(), options));
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    int file() const {
+        return fd;
+    }
+
+    // Raw mapping for structures that live inside the file (indexes), not pinned
+    T *mapped() const {
+        return data;
+    }
+
+    // Pinned view of up to count elements at offset, clamped to the storage end
+    BlockView<T> view(size_t offset, size_t count) {
+        count = clamp_data_count(offset, count, n);
+        if (count == 0) {
+            return BlockView<T>();
+        }
+        return BlockView<T>(&pins, std::span<const T>(data + offset, count));
+    }
+
+    BlockView<T> view() {
+        return view(0, n);
+    }
+
+    // How much of the mapping actually ended up in huge pages
+    HugePageStats huge_page_stats() const {
+        return get_huge_page_stats(data);
+    }
+
+    bool pinned() const {
+        return pins.load(std::memory_order_acquire) > 0;
+    }
+
+    void advise(AccessMode mode) {
+        advise(mode, 0, n);
+    }
+
+    void advise(AccessMode mode, size_t offset, size_t count) {
+        count = clamp_data_count(offset, count, n);
+        if (count) {
+            advise_data(fd, data, offset * sizeof(T), count * sizeof(T), mode);
+        }
+    }
+
+    // Starts asynchronous readahead of the range, returns immediately
+    void prefetch(size_t offset, size_t count) {
+        count = clamp_data_count(offset, count, n);
+        if (count) {
+            prefetch_data(fd, data, offset * sizeof(T), count * sizeof(T));
+        }
     }
 
     size_t read(size_t offset, T *out_data, size_t data_count) {
@@ -68,18 +228,21 @@ class BlockStorage {
         return write_data(in_data, offset, data_count, data, sizeof(T), n, readonly);
     }
 
+    // msync the mapping; async only schedules the write back
+    void sync(bool async = false) {
+        if (data) {
+            sync_data(data, get_sizeof(), async);
+        }
+    }
+
     void reset(){
-        if (data && data != MAP_FAILED) {
-            if (munmap(data, get_sizeof()) == -1) {
-                show_sys_error("munmap");
-                data = NULL;
-                n = 0;
-            }
+        if (pinned()) {
+            throw std::runtime_error("Cannot reset BlockStorage while views are alive.");
         }
-        fd.reset();
+        unmap();
     }
 
     ~BlockStorage() {
-        reset();
+        unmap();
     }
 };
@@ -0,0 +1,175 @@
+#include "block_checksum.h"
+#include "crc32c.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <utils/exception.h>
+
+
+ChecksumBlockStorage::ChecksumBlockStorage(
+    const char *fname, bool readonly, size_t block_size, MapOptions options
+) : fname(fname), storage(fname, readonly, options), block_size(block_size) {
+    check_layout();
+    if (storage.size() % block_size != 0) {
+        throw std::runtime_error("File size is not a multiple of the checksum block size for `" + this->fname + "`.");
+    }
+    nblocks = storage.size() / block_size;
+    verified.reset(new std::atomic<bool>[nblocks]);
+    clear_verified();
+}
+
+ChecksumBlockStorage::ChecksumBlockStorage(
+    const char *fname, bool readonly, size_t block_size, size_t nblocks, MapOptions options
+) : fname(fname), storage(fname, readonly, block_size * nblocks, options),
+    block_size(block_size), nblocks(nblocks) {
+    check_layout();
+    verified.reset(new std::atomic<bool>[nblocks]);
+    clear_verified();
+    if (!readonly) {
+        for (size_t block = 0; block < nblocks; block++) {
+            update_checksum(block);
+        }
+    }
+}
+
+void ChecksumBlockStorage::check_layout() {
+    if (block_size <= CHECKSUM_SIZE) {
+        throw std::runtime_error("Checksum block size too small for `" + fname + "`.");
+    }
+}
+
+void ChecksumBlockStorage::clear_verified() {
+    for (size_t block = 0; block < nblocks; block++) {
+        verified[block].store(false, std::memory_order_relaxed);
+    }
+}
+
+bool ChecksumBlockStorage::check_block(size_t block) {
+    auto data = storage.view(block * block_size, block_size);
+    uint32_t stored;
+    memcpy(&stored, data.data() + payload_size(), CHECKSUM_SIZE);
+    if (crc32c(0, data.data(), payload_size()) != stored) {
+        return false;
+    }
+    verified[block].store(true, std::memory_order_release);
+    return true;
+}
+
+bool ChecksumBlockStorage::verify_block(size_t block) {
+    if (check_block(block)) {
+        return true;
+    }
+    // The writer may be between the payload and the trailer update
+    std::lock_guard<std::mutex> guard(block_lock(block));
+    return check_block(block);
+}
+
+void ChecksumBlockStorage::ensure_verified(size_t block) {
+    if (!is_verified(block) && !verify_block(block)) {
+        throw IntegrityError("Checksum mismatch in block " + std::to_string(block) + " of `" + fname + "`");
+    }
+}
+
+// Caller holds block_lock(block) unless nothing else can see the storage yet
+void ChecksumBlockStorage::update_checksum(size_t block) {
+    auto data = storage.view(block * block_size, payload_size());
+    uint32_t crc = crc32c(0, data.data(), data.size());
+    storage.write(block * block_size + payload_size(), reinterpret_cast<const byte*>(&crc), CHECKSUM_SIZE);
+    verified[block].store(true, std::memory_order_release);
+}
+
+size_t ChecksumBlockStorage::read(size_t offset, byte *out_data, size_t data_count) {
+    data_count = clamp_data_count(offset, data_count, size());
+    for (size_t done = 0; done < data_count; ) {
+        auto block = (offset + done) / payload_size();
+        auto block_offset = (offset + done) % payload_size();
+        auto count = std::min(data_count - done, payload_size() - block_offset);
+        ensure_verified(block);
+        storage.read(block * block_size + block_offset, out_data + done, count);
+        done += count;
+    }
+    return data_count;
+}
+
+size_t ChecksumBlockStorage::write(size_t offset, const byte *in_data, size_t data_count) {
+    data_count = clamp_data_count(offset, data_count, size());
+    for (size_t done = 0; done < data_count; ) {
+        auto block = (offset + done) / payload_size();
+        auto block_offset = (offset + done) % payload_size();
+        auto count = std::min(data_count - done, payload_size() - block_offset);
+        if (count < payload_size()) {
+            // Partial update - don't bake corruption of the untouched bytes into a fresh checksum
+            ensure_verified(block);
+        }
+        {
+            std::lock_guard<std::mutex> guard(block_lock(block));
+            storage.write(block * block_size + block_offset, in_data + done, count);
+            update_checksum(block);
+        }
+        done += count;
+    }
+    return data_count;
+}
+
+ChecksumScrubber::ChecksumScrubber(
+    ChecksumBlockStorage &storage, double bytes_per_sec,
+    Tcallback on_corrupt, double pass_interval_sec
+) : storage(&storage), bytes_per_sec(bytes_per_sec),
+    pass_interval_sec(pass_interval_sec), on_corrupt(std::move(on_corrupt)) {}
+
+void ChecksumScrubber::start() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (running) {
+        return;
+    }
+    running = true;
+    thread = std::thread(&ChecksumScrubber::scrub_loop, this);
+}
+
+void ChecksumScrubber::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    cv.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool ChecksumScrubber::wait_sec(double sec) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (sec > 0) {
+        cv.wait_for(guard, std::chrono::duration<double>(sec), [this] { return !running; });
+    }
+    return running;
+}
+
+void ChecksumScrubber::scrub_loop() {
+    // Throttle in small bursts instead of sleeping after every block
+    const size_t burst_bytes = std::max<size_t>(1 << 20, storage->payload_size());
+    while (true) {
+        size_t burst = 0;
+        for (size_t block = 0; block < storage->block_count(); block++) {
+            if (storage->is_verified(block)) {
+                continue;
+            }
+            if (!storage->verify_block(block) && on_corrupt) {
+                on_corrupt(block);
+            }
+            burst += storage->payload_size();
+            if (burst >= burst_bytes) {
+                if (!wait_sec(burst / bytes_per_sec)) {
+                    return;
+                }
+                burst = 0;
+            }
+        }
+        if (!wait_sec(pass_interval_sec)) {
+            return;
+        }
+        storage->clear_verified();
+    }
+}
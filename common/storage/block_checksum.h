@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "block.h"
+
+
+constexpr static size_t CHECKSUM_SIZE = sizeof(uint32_t);
+constexpr static size_t CHECKSUM_LOCK_STRIPES = 64;
+
+// Byte storage split into fixed blocks, each ending with a crc32c trailer of its payload:
+//   [payload (block_size - CHECKSUM_SIZE) | crc32c] * nblocks
+// Offsets/counts in read/write address the payload bytes only.
+// Blocks are verified lazily on first read; a failed check throws IntegrityError.
+// Single writer; concurrent readers are fine. A payload write and its trailer update happen
+// under the block lock, a failed check is repeated under it before it is reported.
+class ChecksumBlockStorage {
+    std::string fname;
+    BlockStorage<byte> storage;
+    size_t block_size;
+    size_t nblocks;
+    std::unique_ptr<std::atomic<bool>[]> verified;
+    std::mutex block_locks[CHECKSUM_LOCK_STRIPES];
+
+    std::mutex &block_lock(size_t block) {
+        return block_locks[block % CHECKSUM_LOCK_STRIPES];
+    }
+
+    void check_layout();
+    bool check_block(size_t block);
+    void ensure_verified(size_t block);
+    void update_checksum(size_t block);
+
+    public:
+    ChecksumBlockStorage(
+        const char *fname, bool readonly = true, size_t block_size = 4096, MapOptions options = {}
+    );
+    // Creates/resizes the file to nblocks and writes trailers for all blocks
+    ChecksumBlockStorage(
+        const char *fname, bool readonly, size_t block_size, size_t nblocks, MapOptions options = {}
+    );
+
+    size_t payload_size() const {
+        return block_size - CHECKSUM_SIZE;
+    }
+
+    size_t block_count() const {
+        return nblocks;
+    }
+
+    size_t size() const {
+        return nblocks * payload_size();
+    }
+
+    bool is_verified(size_t block) const {
+        return verified[block].load(std::memory_order_acquire);
+    }
+
+    // Recomputes the payload checksum, marks the block verified when it matches.
+    // A mismatch is checked again under the block lock, so a concurrent write is not reported.
+    bool verify_block(size_t block);
+
+    // Forget verification state, so every block is checked again on next read
+    void clear_verified();
+
+    size_t read(size_t offset, byte *out_data, size_t data_count);
+    size_t write(size_t offset, const byte *in_data, size_t data_count);
+};
+
+// Background thread verifying blocks nobody has read (and so checked) yet.
+// Reads are throttled to bytes_per_sec; after each full pass it sleeps pass_interval_sec
+// and clears the verified state so the next pass covers the whole file again.
+class ChecksumScrubber {
+    using Tcallback = std::function<void(size_t block)>;
+
+    ChecksumBlockStorage *storage;
+    double bytes_per_sec;
+    double pass_interval_sec;
+    Tcallback on_corrupt;
+
+    std::mutex lock;
+    std::condition_variable cv;
+    bool running = false;
+    std::thread thread;
+
+    bool wait_sec(double sec);  // false when stopped during the wait
+    void scrub_loop();
+
+    public:
+    ChecksumScrubber(
+        ChecksumBlockStorage &storage, double bytes_per_sec,
+        Tcallback on_corrupt, double pass_interval_sec = 3600
+    );
+
+    void start();
+    void stop();
+
+    ~ChecksumScrubber() {
+        stop();
+    }
+};
@@ -0,0 +1,97 @@
+#include "block_numa.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+
+// maxnode counts bits of the mask, the kernel ignores the last one
+constexpr static unsigned long NUMA_MASK_BITS = 65;
+
+static long mbind_range(void *data, size_t size, int mode, uint64_t node_mask, unsigned flags) {
+    const uint64_t *mask = mode == MPOL_DEFAULT ? NULL : &node_mask;
+    return syscall(SYS_mbind, data, size, mode, mask, mask ? NUMA_MASK_BITS : 0, flags);
+}
+
+// Reads a byte of every page from a helper thread running under the policy
+static void numa_populate(const void *data, size_t size, int mode, uint64_t node_mask) {
+    int err = 0;
+    std::thread thread([&]() {
+        if (syscall(SYS_set_mempolicy, mode, &node_mask, NUMA_MASK_BITS) == -1) {
+            err = errno;
+            return;
+        }
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto bytes = static_cast<const volatile byte*>(data);
+        for (size_t offset = 0; offset < size; offset += page) {
+            bytes[offset];
+        }
+    });
+    thread.join();
+    if (err) {
+        errno = err;
+        throw_sys_error("set numa memory policy");
+    }
+}
+
+void numa_place_data(void *data, size_t size, NumaPolicy policy, uint64_t node_mask) {
+    if (!data || !size || numa_node_count() <= 1) {
+        return;
+    }
+    if (numa_node_count() < 64) {
+        node_mask &= (1ULL << numa_node_count()) - 1;
+    }
+    int mode;
+    switch (policy) {
+        case NumaPolicy::INTERLEAVE:
+            mode = MPOL_INTERLEAVE;
+            break;
+        case NumaPolicy::BIND:
+            mode = MPOL_BIND;
+            break;
+        default:
+            mode = MPOL_DEFAULT;
+            break;
+    }
+    if (mode != MPOL_DEFAULT && !node_mask) {
+        throw std::invalid_argument("NUMA node mask selects no node of this machine.");
+    }
+    if (mbind_range(data, size, mode, node_mask, MPOL_MF_MOVE) == -1) {
+        throw_sys_error("mbind mapped data");
+    }
+    if (mode != MPOL_DEFAULT) {
+        numa_populate(data, size, mode, node_mask);
+    }
+}
+
+void *numa_alloc_on_node(size_t size, int node) {
+    if (node < 0 || node >= 64) {
+        throw std::invalid_argument("NUMA node " + std::to_string(node) + " out of range.");
+    }
+    if (!size) {
+        return NULL;
+    }
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        throw_sys_error("allocate numa replica");
+    }
+    // Policy is set before the first touch, so the copy faults pages in on the node.
+    // Single node machines may lack mbind, their memory is local anyway.
+    if (numa_node_count() > 1 && mbind_range(data, size, MPOL_BIND, 1ULL << node, 0) == -1) {
+        auto err = errno;
+        munmap(data, size);
+        errno = err;
+        throw_sys_error("mbind numa replica");
+    }
+    return data;
+}
+
+void numa_free(void *data, size_t size) {
+    if (data && munmap(data, size) == -1) {
+        show_sys_error("munmap numa replica");
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <utils/sys/numa.h>
+
+#include "block.h"
+
+
+enum class NumaPolicy {
+    DEFAULT,     // first touch
+    INTERLEAVE,  // pages round robin over node_mask
+    BIND         // pages only on node_mask
+};
+
+constexpr static uint64_t NUMA_ALL_NODES = ~0ULL;
+
+// Places a mapped range: mbind for the mapping (pages only this process maps are migrated),
+// then the range is faulted in from a thread running under the same policy - page cache pages
+// of a shared file mapping follow the policy of the task that faults them, not the mapping's.
+// Pages other processes keep cached stay where they are, and pages evicted and faulted in again
+// later land on the node of whoever faults them; only NumaReplica guarantees node local memory.
+// Throws when the kernel rejects the policy. No-op on machines with a single node.
+void numa_place_data(void *data, size_t size, NumaPolicy policy, uint64_t node_mask = NUMA_ALL_NODES);
+// Anonymous memory bound to node, NULL for size 0
+void *numa_alloc_on_node(size_t size, int node);
+void numa_free(void *data, size_t size);
+
+template<class T>
+void numa_place(BlockStorage<T> &storage, NumaPolicy policy, uint64_t node_mask = NUMA_ALL_NODES) {
+    auto data = storage.view();
+    numa_place_data(const_cast<T*>(data.data()), storage.get_sizeof(), policy, node_mask);
+}
+
+// Per-node private copies of read-only data (e.g. a static index). Lookups from threads
+// pinned with pin_thread_to_node() always hit memory of their own node.
+template<class T>
+class NumaReplica {
+    std::vector<T*> replicas;
+    size_t n;
+
+    public:
+    NumaReplica(std::span<const T> data) : n(data.size()) {
+        for (int node = 0; node < numa_node_count(); node++) {
+            auto replica = static_cast<T*>(numa_alloc_on_node(n * sizeof(T), node));
+            std::copy(data.begin(), data.end(), replica);
+            replicas.push_back(replica);
+        }
+    }
+
+    NumaReplica(const NumaReplica&) = delete;
+    NumaReplica& operator=(const NumaReplica&) = delete;
+
+    std::span<const T> node(int node) const {
+        return std::span<const T>(replicas[node % replicas.size()], n);
+    }
+
+    // Replica of the node the calling thread runs on
+    std::span<const T> local() const {
+        return node(numa_current_node());
+    }
+
+    ~NumaReplica() {
+        for (auto replica : replicas) {
+            numa_free(replica, n * sizeof(T));
+        }
+    }
+};
@@ -0,0 +1,48 @@
+#include "block_segmented.h"
+
+#include <cerrno>
+#include <cstdio>
+
+
+constexpr static uint64_t SEGMENTED_MAGIC = 0x31474553534444ULL;  // "DDSSEG1"
+
+std::string segment_path(const std::string &dirname, size_t segment) {
+    char name[32];
+    snprintf(name, sizeof(name), "/seg_%08zu", segment);
+    return dirname + name;
+}
+
+unique_fd open_segmented_meta(const std::string &dirname, bool readonly, SegmentedMeta *meta) {
+    if (!readonly && mkdir(dirname.c_str(), S_IRWXU) == -1 && errno != EEXIST) {
+        throw_sys_error("create segment directory `" + dirname + "`");
+    }
+
+    auto path = dirname + "/meta";
+    unique_fd fd = open(path.c_str(), get_open_flags(readonly, !readonly), S_IRUSR | S_IWUSR);
+    if (!fd.valid()) {
+        throw_sys_error("open segment meta `" + path + "`");
+    }
+
+    SegmentedMeta stored;
+    auto ret = pread(fd, &stored, sizeof(stored), 0);
+    if (ret == -1) {
+        throw_sys_error("read segment meta `" + path + "`");
+    }
+    if (ret == 0 && !readonly) {
+        // Fresh directory - keep the caller's layout
+        meta->magic = SEGMENTED_MAGIC;
+        store_segmented_meta(fd, *meta);
+        return fd;
+    }
+    if (ret != sizeof(stored) || stored.magic != SEGMENTED_MAGIC) {
+        throw std::runtime_error("Invalid segment meta in `" + path + "`.");
+    }
+    *meta = stored;
+    return fd;
+}
+
+void store_segmented_meta(int fd, const SegmentedMeta &meta) {
+    if (pwrite(fd, &meta, sizeof(meta), 0) != sizeof(meta)) {
+        throw_sys_error("write segment meta");
+    }
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block.h"
+
+
+typedef struct SegmentedMeta {
+    uint64_t magic;
+    uint64_t elem_size;
+    uint64_t segment_shift;
+    uint64_t n;
+} SegmentedMeta;
+
+std::string segment_path(const std::string &dirname, size_t segment);
+unique_fd open_segmented_meta(const std::string &dirname, bool readonly, SegmentedMeta *meta);
+void store_segmented_meta(int fd, const SegmentedMeta &meta);
+
+// Directory of fixed-size segment files, each mapped once at its full size.
+// Growth only adds segments, so element pointers stay valid for the storage lifetime
+// and readers translate indexes without locking while a single writer appends.
+template<class T = byte>
+class SegmentedBlockStorage {
+    std::string dirname;
+    unique_fd meta_fd;
+    SegmentedMeta meta;
+    bool readonly;
+    size_t max_segments;
+    AccessMode access_mode = AccessMode::NORMAL;
+
+    std::mutex grow_lock;
+    std::vector<unique_fd> segment_fds;
+    std::unique_ptr<std::atomic<T*>[]> segments;  // fixed capacity - never reallocated
+    std::atomic<size_t> nsegments = 0;
+    std::atomic<size_t> n = 0;
+
+    size_t segment_bytes() const {
+        return segment_elems() * sizeof(T);
+    }
+
+    void map_segment(size_t segment) {
+        auto path = segment_path(dirname, segment);
+        unique_fd fd;
+        if (readonly) {
+            // Segments are created whole, mapping past the end of a short one would SIGBUS on access
+            size_t size;
+            fd = open_data_file(path.c_str(), true, &size);
+            if (size < segment_bytes()) {
+                throw std::runtime_error("Segment file `" + path + "` is truncated.");
+            }
+        } else {
+            fd = init_data_file(path.c_str(), false, segment_bytes());
+        }
+        auto ptr = static_cast<T*>(mmap_data(fd, path.c_str(), readonly, segment_bytes()));
+        if (access_mode != AccessMode::NORMAL) {
+            advise_data(fd, ptr, 0, segment_bytes(), access_mode);
+        }
+        segment_fds.emplace_back(std::move(fd));
+        segments[segment].store(ptr, std::memory_order_release);
+    }
+
+    void map_segments(size_t count) {
+        if (count > max_segments) {
+            throw std::runtime_error("Segment limit exceeded for `" + dirname + "`.");
+        }
+        for (size_t segment = nsegments; segment < count; segment++) {
+            map_segment(segment);
+            nsegments.store(segment + 1, std::memory_order_release);
+        }
+    }
+
+    // Maps the segments of new_n elements, size() is unchanged until publish_size_unsafe
+    void reserve_unsafe(size_t new_n) {
+        if (readonly) {
+            throw std::runtime_error("Cannot grow a readonly SegmentedBlockStorage instance.");
+        }
+        map_segments((new_n + segment_elems() - 1) >> meta.segment_shift);
+    }
+
+    void publish_size_unsafe(size_t new_n) {
+        meta.n = new_n;
+        store_segmented_meta(meta_fd, meta);
+        n.store(new_n, std::memory_order_release);
+    }
+
+    void grow_unsafe(size_t new_n) {
+        if (new_n <= n.load(std::memory_order_relaxed)) {
+            return;
+        }
+        reserve_unsafe(new_n);
+        publish_size_unsafe(new_n);
+    }
+
+    // Range must lie in mapped segments, not necessarily below size()
+    void write_segments(size_t offset, const T *in_data, size_t data_count) {
+        for (size_t done = 0; done < data_count; ) {
+            auto [segment, seg_offset] = locate(offset + done);
+            auto count = std::min(data_count - done, segment_elems() - seg_offset);
+            write_data(
+                in_data + done, seg_offset, count,
+                segments[segment].load(std::memory_order_acquire), sizeof(T), segment_elems(), readonly
+            );
+            done += count;
+        }
+    }
+
+    public:
+    SegmentedBlockStorage(
+        const char *dirname, bool readonly = true,
+        unsigned segment_shift = 20, size_t max_segments = 1 << 16
+    ) : dirname(dirname), readonly(readonly), max_segments(max_segments),
+        segments(new std::atomic<T*>[max_segments]) {
+        meta.elem_size = sizeof(T);
+        meta.segment_shift = segment_shift;
+        meta.n = 0;
+        meta_fd = open_segmented_meta(this->dirname, readonly, &meta);
+        if (meta.elem_size != sizeof(T)) {
+            throw std::runtime_error("Element size mismatch for `" + this->dirname + "`.");
+        }
+        for (size_t segment = 0; segment < max_segments; segment++) {
+            segments[segment].store(NULL, std::memory_order_relaxed);
+        }
+        map_segments((meta.n + segment_elems() - 1) >> meta.segment_shift);
+        n.store(meta.n, std::memory_order_release);
+    }
+
+    SegmentedBlockStorage(const SegmentedBlockStorage&) = delete;
+    SegmentedBlockStorage& operator=(const SegmentedBlockStorage&) = delete;
+
+    size_t size() const {
+        return n.load(std::memory_order_acquire);
+    }
+
+    size_t segment_elems() const {
+        return size_t(1) << meta.segment_shift;
+    }
+
+    // element index -> (segment, offset in segment)
+    std::pair<size_t, size_t> locate(size_t idx) const {
+        return std::make_pair(idx >> meta.segment_shift, idx & (segment_elems() - 1));
+    }
+
+    // Stable pointer to element idx, which must be below size()
+    T *at(size_t idx) const {
+        auto [segment, offset] = locate(idx);
+        return segments[segment].load(std::memory_order_acquire) + offset;
+    }
+
+    // Applied to every mapped segment and remembered for segments added later
+    void advise(AccessMode mode) {
+        std::lock_guard<std::mutex> guard(grow_lock);
+        access_mode = mode;
+        for (size_t segment = 0; segment < nsegments; segment++) {
+            advise_data(segment_fds[segment], segments[segment], 0, segment_bytes(), mode);
+        }
+    }
+
+    // Starts asynchronous readahead of the range, returns immediately
+    void prefetch(size_t offset, size_t count) {
+        count = clamp_data_count(offset, count, size());
+        for (size_t done = 0; done < count; ) {
+            auto [segment, seg_offset] = locate(offset + done);
+            auto seg_count = std::min(count - done, segment_elems() - seg_offset);
+            prefetch_data(
+                -1, segments[segment].load(std::memory_order_acquire),
+                seg_offset * sizeof(T), seg_count * sizeof(T)
+            );
+            done += seg_count;
+        }
+    }
+
+    size_t read(size_t offset, T *out_data, size_t data_count) const {
+        data_count = clamp_data_count(offset, data_count, size());
+        for (size_t done = 0; done < data_count; ) {
+            auto [segment, seg_offset] = locate(offset + done);
+            auto count = std::min(data_count - done, segment_elems() - seg_offset);
+            read_data(
+                segments[segment].load(std::memory_order_acquire), sizeof(T), segment_elems(),
+                out_data + done, seg_offset, count
+            );
+            done += count;
+        }
+        return data_count;
+    }
+
+    size_t write(size_t offset, const T *in_data, size_t data_count) {
+        data_count = clamp_data_count(offset, data_count, size());
+        write_segments(offset, in_data, data_count);
+        return data_count;
+    }
+
+    // Extends the storage to new_n elements (new elements are zeroed), never shrinks
+    void grow(size_t new_n) {
+        std::lock_guard<std::mutex> guard(grow_lock);
+        grow_unsafe(new_n);
+    }
+
+    // Returns the offset of the first appended element. The data is written before the new
+    // size is published, so lock-free readers never see the appended range unwritten.
+    size_t append(const T *in_data, size_t data_count) {
+        std::lock_guard<std::mutex> guard(grow_lock);
+        auto offset = n.load(std::memory_order_relaxed);
+        if (!data_count) {
+            return offset;
+        }
+        reserve_unsafe(offset + data_count);
+        write_segments(offset, in_data, data_count);
+        publish_size_unsafe(offset + data_count);
+        return offset;
+    }
+
+    void reset() {
+        for (size_t segment = 0; segment < nsegments; segment++) {
+            auto ptr = segments[segment].exchange(NULL);
+            if (ptr) {
+                unmap_data(ptr, segment_bytes());
+            }
+        }
+        nsegments = 0;
+        n = 0;
+        segment_fds.clear();
+        meta_fd.reset();
+    }
+
+    ~SegmentedBlockStorage() {
+        reset();
+    }
+};
@@ -0,0 +1,77 @@
+#include "block_snapshot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+
+SnapshotMode clone_data_file(int src_fd, const char *dst_fname) {
+    unique_fd dst_fd = open(dst_fname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (!dst_fd.valid()) {
+        throw_sys_error("create snapshot file `" + std::string(dst_fname) + "`");
+    }
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        return SnapshotMode::REFLINK;
+    }
+    if (errno != EOPNOTSUPP && errno != EXDEV && errno != EINVAL && errno != ENOTTY) {
+        throw_sys_error("clone into snapshot file `" + std::string(dst_fname) + "`");
+    }
+
+    // No reflink here - fall back to an in-kernel copy
+    struct stat st;
+    if (fstat(src_fd, &st) == -1) {
+        throw_sys_error("fstat snapshot source");
+    }
+    loff_t src_off = 0, dst_off = 0;
+    while (src_off < st.st_size) {
+        auto ret = copy_file_range(src_fd, &src_off, dst_fd, &dst_off, st.st_size - src_off, 0);
+        if (ret == -1) {
+            throw_sys_error("copy into snapshot file `" + std::string(dst_fname) + "`");
+        }
+        if (ret == 0) {
+            break;
+        }
+    }
+    if (fdatasync(dst_fd) == -1) {
+        throw_sys_error("fdatasync snapshot file `" + std::string(dst_fname) + "`");
+    }
+    return SnapshotMode::COPY;
+}
+
+void PageShadow::preserve(size_t offset, size_t len) {
+    if (!len) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    auto last = std::min(offset + len, size) - 1;
+    for (auto page = offset / page_size; page <= last / page_size; page++) {
+        if (pages.count(page)) {
+            continue;
+        }
+        auto start = page * page_size;
+        auto count = std::min(page_size, size - start);
+        auto copy = std::make_unique<byte[]>(page_size);
+        memcpy(copy.get(), live + start, count);
+        pages.emplace(page, std::move(copy));
+    }
+}
+
+size_t PageShadow::read(size_t offset, byte *out_data, size_t len) {
+    len = clamp_data_count(offset, len, size);
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t done = 0; done < len; ) {
+        auto page = (offset + done) / page_size;
+        auto page_offset = (offset + done) % page_size;
+        auto count = std::min(len - done, page_size - page_offset);
+        // Holding the lock keeps writers from preserving, and so from changing, this page meanwhile
+        auto it = pages.find(page);
+        auto src = it != pages.end() ? it->second.get() + page_offset : live + offset + done;
+        memcpy(out_data + done, src, count);
+        done += count;
+    }
+    return len;
+}
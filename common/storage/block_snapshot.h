@@ -0,0 +1,127 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "block.h"
+
+
+enum class SnapshotMode {
+    REFLINK,  // FICLONE - shares extents, instant
+    COPY      // filesystem has no reflink, data was copied
+};
+
+SnapshotMode clone_data_file(int src_fd, const char *dst_fname);
+
+// Pages of one frozen version that writers have overwritten since it was taken.
+// Writers call preserve() before touching a range; readers get the frozen bytes from
+// here or, for pages nobody changed, straight from the live mapping.
+class PageShadow {
+    std::mutex lock;
+    const byte *live;
+    size_t size;
+    size_t page_size;
+    std::unordered_map<size_t, std::unique_ptr<byte[]>> pages;
+
+    public:
+    PageShadow(const byte *live, size_t size, size_t page_size = 4096)
+        : live(live), size(size), page_size(page_size) {}
+
+    void preserve(size_t offset, size_t len);
+    size_t read(size_t offset, byte *out_data, size_t len);
+
+    size_t shadow_bytes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return pages.size() * page_size;
+    }
+};
+
+// Point-in-time read-only version of a SnapshotBlockStorage; writers continue meanwhile.
+// Pins the live mapping, so it must not outlive the storage.
+template<class T>
+class BlockSnapshot {
+    BlockView<T> live;
+    std::shared_ptr<PageShadow> shadow;
+    size_t n;
+
+    public:
+    BlockSnapshot(BlockView<T> live, std::shared_ptr<PageShadow> shadow)
+        : live(std::move(live)), shadow(std::move(shadow)), n(this->live.size()) {}
+
+    size_t size() const {
+        return n;
+    }
+
+    size_t read(size_t offset, T *out_data, size_t data_count) {
+        data_count = clamp_data_count(offset, data_count, n);
+        shadow->read(offset * sizeof(T), reinterpret_cast<byte*>(out_data), data_count * sizeof(T));
+        return data_count;
+    }
+
+    // Consistent copy of the frozen version, e.g. for a backup
+    void save(const char *fname, size_t chunk = 1 << 16) {
+        BlockStorage<T> out(fname, false, n);
+        std::vector<T> buf(chunk);
+        for (size_t offset = 0; offset < n; offset += chunk) {
+            auto count = read(offset, buf.data(), chunk);
+            out.write(offset, buf.data(), count);
+        }
+        out.sync();
+    }
+};
+
+// BlockStorage with snapshots: page-level copy-on-write shadows kept by the library,
+// or a reflink clone of the whole file where the filesystem supports it.
+template<class T = byte>
+class SnapshotBlockStorage {
+    BlockStorage<T> storage;
+    std::mutex write_lock;
+    std::vector<std::weak_ptr<PageShadow>> shadows;
+
+    public:
+    SnapshotBlockStorage(const char *fname, bool readonly = true, MapOptions options = {})
+        : storage(fname, readonly, options) {}
+    SnapshotBlockStorage(const char *fname, bool readonly, size_t n, MapOptions options = {})
+        : storage(fname, readonly, n, options) {}
+
+    size_t size() const {
+        return storage.size();
+    }
+
+    size_t read(size_t offset, T *out_data, size_t data_count) {
+        return storage.read(offset, out_data, data_count);
+    }
+
+    size_t write(size_t offset, const T *in_data, size_t data_count) {
+        std::lock_guard<std::mutex> guard(write_lock);
+        data_count = clamp_data_count(offset, data_count, storage.size());
+        for (auto it = shadows.begin(); it != shadows.end(); ) {
+            if (auto shadow = it->lock()) {
+                shadow->preserve(offset * sizeof(T), data_count * sizeof(T));
+                it++;
+            } else {
+                it = shadows.erase(it);
+            }
+        }
+        return storage.write(offset, in_data, data_count);
+    }
+
+    BlockSnapshot<T> snapshot() {
+        std::lock_guard<std::mutex> guard(write_lock);
+        auto live = storage.view();
+        auto shadow = std::make_shared<PageShadow>(
+            reinterpret_cast<const byte*>(live.data()), storage.get_sizeof()
+        );
+        shadows.emplace_back(shadow);
+        return BlockSnapshot<T>(std::move(live), shadow);
+    }
+
+    // File level snapshot; writes through this object wait until the clone is done
+    SnapshotMode clone_to(const char *dst_fname) {
+        std::lock_guard<std::mutex> guard(write_lock);
+        storage.sync();
+        return clone_data_file(storage.file(), dst_fname);
+    }
+};
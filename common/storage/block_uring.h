@@ -0,0 +1,91 @@
+#pragma once
+
+#include "block.h"
+#include "uring.h"
+
+
+// BlockStorage backend that moves data through io_uring instead of faulting on a mapping.
+// read/write only queue the transfer; the caller owns out_data/in_data until the
+// completion with the same tag is reported by UringEngine::poll_completions.
+template<class T = byte>
+class UringBlockStorage {
+    UringEngine *engine;
+    unique_fd fd;
+    int file_idx = -1;
+    std::size_t n = 0;
+    bool readonly;
+
+    public:
+    size_t get_sizeof() const {
+        return n * sizeof(T);
+    }
+
+    UringBlockStorage(UringEngine &engine, const char *fname, bool readonly = true)
+        : engine(&engine), readonly(readonly) {
+        size_t size;
+        fd = open_data_file(fname, readonly, &size);
+        if (size % sizeof(T) != 0) {
+            throw std::runtime_error("File size is not a multiple of the element size for `" + std::string(fname) + "`.");
+        }
+        n = size / sizeof(T);
+        file_idx = engine.add_file(fd);
+    }
+
+    UringBlockStorage(UringEngine &engine, const char *fname, bool readonly, size_t n)
+        : engine(&engine), n(n), readonly(readonly) {
+        fd = init_data_file(fname, readonly, get_sizeof());
+        file_idx = engine.add_file(fd);
+    }
+
+    UringBlockStorage(const UringBlockStorage&) = delete;
+    UringBlockStorage& operator=(const UringBlockStorage&) = delete;
+
+    size_t size() const {
+        return n;
+    }
+
+    // Returns the number of elements queued (clamped to the file end), 0 if nothing was queued.
+    // buf_idx selects a buffer registered with the engine that contains out_data.
+    size_t read(size_t offset, T *out_data, size_t data_count, uint64_t tag, int buf_idx = -1) {
+        data_count = clamp_data_count(offset, data_count, n);
+        if (data_count == 0) {
+            return 0;
+        }
+        if (!engine->queue_read(
+            file_idx, out_data, data_count * sizeof(T), offset * sizeof(T), tag, buf_idx
+        )) {
+            return 0;
+        }
+        return data_count;
+    }
+
+    size_t write(size_t offset, const T *in_data, size_t data_count, uint64_t tag, int buf_idx = -1) {
+        data_count = clamp_data_count(offset, data_count, n);
+        if (data_count == 0) {
+            return 0;
+        }
+        if (readonly) {
+            throw std::runtime_error("Cannot write to a readonly UringBlockStorage instance.");
+        }
+        if (!engine->queue_write(
+            file_idx, in_data, data_count * sizeof(T), offset * sizeof(T), tag, buf_idx
+        )) {
+            return 0;
+        }
+        return data_count;
+    }
+
+    // Caller must have reaped all completions for this file before closing it
+    void reset() {
+        if (file_idx >= 0) {
+            engine->remove_file(file_idx);
+            file_idx = -1;
+        }
+        n = 0;
+        fd.reset();
+    }
+
+    ~UringBlockStorage() {
+        reset();
+    }
+};
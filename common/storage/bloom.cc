@@ -0,0 +1,131 @@
+#include "bloom.h"
+
+#include <algorithm>
+#include <climits>
+#include <filesystem>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+constexpr static uint64_t BLOOM_MAGIC = 0x314d4f4f4c42ULL;  // "BLOOM1"
+
+// Odd multipliers, one per block word
+alignas(32) constexpr static uint32_t BLOOM_SALT[BLOOM_BLOCK_WORDS] = {
+    0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+    0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31
+};
+
+std::string bloom_path(const char *index_fname) {
+    return std::string(index_fname) + ".bloom";
+}
+
+std::unique_ptr<BloomFilter> open_bloom_filter(const char *index_fname) {
+    auto path = bloom_path(index_fname);
+    if (!std::filesystem::exists(path)) {
+        return nullptr;
+    }
+    return std::make_unique<BloomFilter>(path.c_str());
+}
+
+void remove_bloom_filter(const char *index_fname) {
+    auto path = bloom_path(index_fname);
+    std::error_code err;
+    std::filesystem::remove(path, err);
+    if (err) {
+        throw std::runtime_error("Cannot remove `" + path + "`: " + err.message());
+    }
+}
+
+uint64_t bloom_blocks(size_t expected_keys, unsigned bits_per_key) {
+    uint64_t bits = (uint64_t)expected_keys * bits_per_key;
+    uint64_t nblocks = (bits + BLOOM_BLOCK_SIZE * 8 - 1) / (BLOOM_BLOCK_SIZE * 8);
+    // Blocks are picked with a 32-bit range reduction
+    return std::min<uint64_t>(std::max<uint64_t>(nblocks, 1), UINT32_MAX);
+}
+
+void init_bloom_header(BloomHeader *hdr, uint64_t nblocks) {
+    hdr->nblocks = nblocks;
+    hdr->nkeys = 0;
+    hdr->magic = BLOOM_MAGIC;
+}
+
+void check_bloom_header(const BloomHeader *hdr, size_t file_size) {
+    if (file_size < sizeof(*hdr) || hdr->magic != BLOOM_MAGIC) {
+        throw std::runtime_error("Not a bloom filter file.");
+    }
+    if (!hdr->nblocks || file_size < sizeof(*hdr) + hdr->nblocks * BLOOM_BLOCK_SIZE) {
+        throw std::runtime_error("Bloom filter file is truncated or corrupted.");
+    }
+}
+
+static void bloom_block_add_sw(uint32_t *block, uint32_t h) {
+    for (size_t it = 0; it < BLOOM_BLOCK_WORDS; it++) {
+        block[it] |= uint32_t(1) << ((h * BLOOM_SALT[it]) >> 27);
+    }
+}
+
+static bool bloom_block_check_sw(const uint32_t *block, uint32_t h) {
+    for (size_t it = 0; it < BLOOM_BLOCK_WORDS; it++) {
+        if (!(block[it] & (uint32_t(1) << ((h * BLOOM_SALT[it]) >> 27)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static inline __m256i bloom_block_mask(uint32_t h) {
+    auto salt = _mm256_load_si256(reinterpret_cast<const __m256i*>(BLOOM_SALT));
+    auto shift = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(h), salt), 27);
+    return _mm256_sllv_epi32(_mm256_set1_epi32(1), shift);
+}
+
+__attribute__((target("avx2")))
+static void bloom_block_add_avx2(uint32_t *block, uint32_t h) {
+    auto ptr = reinterpret_cast<__m256i*>(block);
+    _mm256_store_si256(ptr, _mm256_or_si256(_mm256_load_si256(ptr), bloom_block_mask(h)));
+}
+
+__attribute__((target("avx2")))
+static bool bloom_block_check_avx2(const uint32_t *block, uint32_t h) {
+    // testc: (~block & mask) == 0, every bit of the mask is set in the block
+    auto data = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+    return _mm256_testc_si256(data, bloom_block_mask(h));
+}
+
+static bool bloom_avx2_available() {
+    static const bool available = __builtin_cpu_supports("avx2");
+    return available;
+}
+
+void bloom_block_add(uint32_t *block, uint32_t h) {
+    if (bloom_avx2_available()) {
+        bloom_block_add_avx2(block, h);
+    } else {
+        bloom_block_add_sw(block, h);
+    }
+}
+
+bool bloom_block_check(const uint32_t *block, uint32_t h) {
+    if (bloom_avx2_available()) {
+        return bloom_block_check_avx2(block, h);
+    }
+    return bloom_block_check_sw(block, h);
+}
+
+#else
+
+void bloom_block_add(uint32_t *block, uint32_t h) {
+    bloom_block_add_sw(block, h);
+}
+
+bool bloom_block_check(const uint32_t *block, uint32_t h) {
+    return bloom_block_check_sw(block, h);
+}
+
+#endif
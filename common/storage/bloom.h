@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "block.h"
+#include "hash.h"
+
+
+typedef struct BloomHeader {
+    uint64_t magic;
+    uint64_t nblocks;
+    uint64_t nkeys;
+    byte _pad[40];
+} BloomHeader;
+
+// 8 x 32-bit words, one bit set per word; two blocks share a cache line
+constexpr static size_t BLOOM_BLOCK_WORDS = 8;
+constexpr static size_t BLOOM_BLOCK_SIZE = BLOOM_BLOCK_WORDS * sizeof(uint32_t);
+// About 1% false positives
+constexpr static unsigned BLOOM_BITS_PER_KEY = 10;
+
+std::string bloom_path(const char *index_fname);
+uint64_t bloom_blocks(size_t expected_keys, unsigned bits_per_key);
+void init_bloom_header(BloomHeader *hdr, uint64_t nblocks);
+void check_bloom_header(const BloomHeader *hdr, size_t file_size);
+void bloom_block_add(uint32_t *block, uint32_t h);
+bool bloom_block_check(const uint32_t *block, uint32_t h);
+
+// Split block Bloom filter over key hashes, persisted in its own file.
+// A key touches a single 32 byte block: the high hash bits select the block, the low
+// 32 bits times 8 odd salts select one bit in each word (AVX2 when available).
+// ~10 bits per key give about 1% false positives.
+class BloomFilter {
+    BlockStorage<byte> storage;
+    BloomHeader *hdr;
+    uint32_t *blocks;
+
+    void attach() {
+        hdr = reinterpret_cast<BloomHeader*>(storage.mapped());
+        blocks = reinterpret_cast<uint32_t*>(storage.mapped() + sizeof(BloomHeader));
+    }
+
+    uint32_t *block(uint64_t hash) const {
+        return blocks + hash_reduce(hash, hdr->nblocks) * BLOOM_BLOCK_WORDS;
+    }
+
+    public:
+    // Open an existing filter
+    BloomFilter(const char *fname, bool readonly = true)
+        : storage(fname, readonly) {
+        attach();
+        check_bloom_header(hdr, storage.size());
+    }
+
+    // Create an empty filter for about expected_keys keys
+    BloomFilter(const char *fname, size_t expected_keys, unsigned bits_per_key)
+        : storage(fname, false, sizeof(BloomHeader) + bloom_blocks(expected_keys, bits_per_key) * BLOOM_BLOCK_SIZE) {
+        attach();
+        memset(storage.mapped(), 0, storage.size());
+        init_bloom_header(hdr, bloom_blocks(expected_keys, bits_per_key));
+    }
+
+    size_t size() const {
+        return hdr->nkeys;
+    }
+
+    size_t size_bytes() const {
+        return hdr->nblocks * BLOOM_BLOCK_SIZE;
+    }
+
+    void clear() {
+        memset(blocks, 0, size_bytes());
+        hdr->nkeys = 0;
+    }
+
+    void add(uint64_t hash) {
+        bloom_block_add(block(hash), hash);
+        hdr->nkeys++;
+    }
+
+    // False means the key is certainly absent
+    bool may_contain(uint64_t hash) const {
+        return bloom_block_check(block(hash), hash);
+    }
+
+    void prefetch(uint64_t hash) const {
+        __builtin_prefetch(block(hash));
+    }
+
+    void sync(bool async = false) {
+        storage.sync(async);
+    }
+};
+
+// `<index_fname>.bloom` when the index was built with a filter, NULL otherwise
+std::unique_ptr<BloomFilter> open_bloom_filter(const char *index_fname);
+// Drops the filter of an earlier build - it would hide keys of the new index
+void remove_bloom_filter(const char *index_fname);
+
+// Filter hash of sorted index keys. Keys the index order treats as equal have to hash alike:
+// -0.0 is folded into 0.0, other keys are hashed by value.
+template<class T>
+struct BloomKeyHash {
+    uint64_t operator()(const T &key) const {
+        if constexpr (std::is_integral_v<T> && sizeof(T) <= sizeof(uint64_t)) {
+            return hash_u64(key);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            T value = key == T(0) ? T(0) : key;
+            return hash_bytes(&value, sizeof(value));
+        } else {
+            static_assert(std::has_unique_object_representations_v<T>, "Keys with padding need their own filter hash.");
+            return hash_bytes(&key, sizeof(key));
+        }
+    }
+};
+
+template<>
+struct BloomKeyHash<std::string_view> {
+    uint64_t operator()(std::string_view key) const {
+        return hash_bytes(key.data(), key.size());
+    }
+};
+
+// Filter for a static (sorted) index, built once next to the index file
+template<class T, class Fhash = BloomKeyHash<T>>
+void build_bloom_filter(
+    const char *fname, std::span<const T> keys, unsigned bits_per_key = BLOOM_BITS_PER_KEY, Fhash hash = Fhash()
+) {
+    BloomFilter filter(fname, keys.size(), bits_per_key);
+    for (auto &key : keys) {
+        filter.add(hash(key));
+    }
+    filter.sync();
+}
@@ -0,0 +1,232 @@
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <sys/uio.h>
+
+
+constexpr static uint64_t DIRECT_FILE_MAGIC = 0x3154434552494444ULL;  // "DDIRECT1"
+
+BufferPool::BufferPool(size_t nframes, size_t page_size)
+    : page_size(page_size), nframes(nframes), frames(nframes) {
+    if (!nframes || page_size % 512 != 0) {
+        throw std::runtime_error("Buffer pool needs frames of a multiple of 512 bytes.");
+    }
+    // Anonymous mapping is page aligned, which is enough for O_DIRECT
+    void *ptr = mmap(NULL, nframes * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        throw_sys_error("allocate buffer pool frames");
+    }
+    memory = static_cast<byte*>(ptr);
+}
+
+void BufferPool::write_back_unsafe(size_t frame) {
+    auto &info = frames[frame];
+    if (pwrite(info.fd, frame_data(frame), page_size, info.page * page_size) != (ssize_t)page_size) {
+        throw_sys_error("write back buffer pool page");
+    }
+    info.dirty = false;
+}
+
+size_t BufferPool::evict_unsafe() {
+    // Two sweeps: the first one may only clear reference bits
+    for (size_t step = 0; step < 2 * nframes; step++) {
+        auto frame = clock_hand;
+        clock_hand = (clock_hand + 1) % nframes;
+        auto &info = frames[frame];
+        if (info.fd == -1) {
+            return frame;
+        }
+        if (info.pins) {
+            continue;
+        }
+        if (info.referenced) {
+            info.referenced = false;
+            continue;
+        }
+        if (info.dirty) {
+            write_back_unsafe(frame);
+        }
+        page_table.erase(PageKey{info.fd, info.page});
+        info.fd = -1;
+        return frame;
+    }
+    throw std::runtime_error("All buffer pool frames are pinned.");
+}
+
+byte *BufferPool::pin(int fd, size_t page, bool fresh) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = page_table.find(PageKey{fd, page});
+    if (it != page_table.end()) {
+        auto &info = frames[it->second];
+        info.pins++;
+        info.referenced = true;
+        return frame_data(it->second);
+    }
+
+    auto frame = evict_unsafe();
+    if (!fresh) {
+        auto ret = pread(fd, frame_data(frame), page_size, page * page_size);
+        if (ret == -1) {
+            throw_sys_error("read buffer pool page");
+        }
+        // Past the end of file
+        std::fill(frame_data(frame) + ret, frame_data(frame) + page_size, 0);
+    }
+    auto &info = frames[frame];
+    info.fd = fd;
+    info.page = page;
+    info.pins = 1;
+    info.referenced = true;
+    info.dirty = false;
+    page_table.emplace(PageKey{fd, page}, frame);
+    return frame_data(frame);
+}
+
+void BufferPool::unpin(int fd, size_t page, bool dirty) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = page_table.find(PageKey{fd, page});
+    if (it == page_table.end()) {
+        return;
+    }
+    auto &info = frames[it->second];
+    if (info.pins > 0) {
+        info.pins--;
+    }
+    info.dirty |= dirty;
+}
+
+void BufferPool::flush(int fd) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<size_t> dirty;
+    for (size_t frame = 0; frame < nframes; frame++) {
+        auto &info = frames[frame];
+        // Pinned frames may be mid-update, they go out on a later flush or eviction
+        if (info.fd != -1 && info.dirty && !info.pins && (fd == -1 || info.fd == fd)) {
+            dirty.push_back(frame);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end(), [&](size_t a, size_t b) {
+        if (frames[a].fd != frames[b].fd) {
+            return frames[a].fd < frames[b].fd;
+        }
+        return frames[a].page < frames[b].page;
+    });
+
+    // Coalesce runs of consecutive pages into one pwritev each
+    std::vector<iovec> iov;
+    for (size_t start = 0; start < dirty.size(); ) {
+        auto &first = frames[dirty[start]];
+        size_t end = start;
+        iov.clear();
+        while (
+            end < dirty.size() && iov.size() < IOV_MAX
+            && frames[dirty[end]].fd == first.fd
+            && frames[dirty[end]].page == first.page + (end - start)
+        ) {
+            iov.push_back(iovec{frame_data(dirty[end]), page_size});
+            end++;
+        }
+        auto len = iov.size() * page_size;
+        if (pwritev(first.fd, iov.data(), iov.size(), first.page * page_size) != (ssize_t)len) {
+            throw_sys_error("write back buffer pool pages");
+        }
+        for (size_t it = start; it < end; it++) {
+            frames[dirty[it]].dirty = false;
+        }
+        start = end;
+    }
+}
+
+void BufferPool::forget(int fd) {
+    flush(fd);
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t frame = 0; frame < nframes; frame++) {
+        auto &info = frames[frame];
+        if (info.fd == fd) {
+            if (info.dirty) {
+                write_back_unsafe(frame);
+            }
+            page_table.erase(PageKey{info.fd, info.page});
+            info = Frame();
+        }
+    }
+}
+
+BufferPool::~BufferPool() {
+    try {
+        flush();
+    } catch (...) {
+        show_sys_error("flush buffer pool");
+    }
+    if (memory) {
+        munmap(memory, nframes * page_size);
+    }
+}
+
+unique_fd open_direct_file(const char *fname, bool readonly, size_t size, size_t page_size, size_t *file_size) {
+    bool create = !readonly && !file_size;
+    unique_fd fd = open(fname, get_open_flags(readonly, create) | O_DIRECT, S_IRUSR | S_IWUSR);
+    if (!fd.valid()) {
+        throw_sys_error("open file for direct I/O `" + std::string(fname) + "`");
+    }
+
+    if (create) {
+        auto pages = (size + page_size - 1) / page_size;
+        if (ftruncate(fd, pages * page_size) == -1) {
+            throw_sys_error("ftruncate file `" + std::string(fname) + "`");
+        }
+    }
+    if (file_size) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            throw_sys_error("fstat file `" + std::string(fname) + "`");
+        }
+        *file_size = st.st_size;
+    }
+    return fd;
+}
+
+void store_direct_header(BufferPool &pool, int fd, size_t elem_size, size_t n) {
+    DirectFileHeader hdr;
+    hdr.magic = DIRECT_FILE_MAGIC;
+    hdr.elem_size = elem_size;
+    hdr.n = n;
+    auto frame = pool.pin(fd, 0, true);
+    memset(frame, 0, pool.get_page_size());
+    memcpy(frame, &hdr, sizeof(hdr));
+    pool.unpin(fd, 0, true);
+    pool.flush(fd);
+}
+
+size_t load_direct_header(BufferPool &pool, int fd, size_t file_size, size_t elem_size, size_t min_n, const char *fname) {
+    auto page_size = pool.get_page_size();
+    if (file_size < DIRECT_HEADER_PAGES * page_size) {
+        throw std::runtime_error("File `" + std::string(fname) + "` has no direct storage header.");
+    }
+    DirectFileHeader hdr;
+    auto frame = pool.pin(fd, 0);
+    memcpy(&hdr, frame, sizeof(hdr));
+    pool.unpin(fd, 0, false);
+
+    const char *error = NULL;
+    if (hdr.magic != DIRECT_FILE_MAGIC) {
+        error = "Not a direct storage file";
+    } else if (hdr.elem_size != elem_size) {
+        error = "Element size mismatch for";
+    } else if (file_size < DIRECT_HEADER_PAGES * page_size + hdr.n * elem_size) {
+        error = "Truncated direct storage file";
+    } else if (hdr.n < min_n) {
+        error = "Fewer elements than requested in";
+    }
+    if (error) {
+        // fd is closed by the failing constructor, its number must not keep a cached page
+        pool.forget(fd);
+        throw std::runtime_error(std::string(error) + " `" + std::string(fname) + "`.");
+    }
+    return hdr.n;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "block.h"
+
+
+// Page cache replacement for files opened with O_DIRECT.
+// Frames are page_size aligned; eviction is CLOCK over unpinned frames, dirty frames are
+// written back in offset order in batches (flush) or one by one when evicted.
+class BufferPool {
+    typedef struct Frame {
+        int fd = -1;
+        size_t page = 0;
+        int pins = 0;
+        bool referenced = false;
+        bool dirty = false;
+    } Frame;
+
+    typedef struct PageKey {
+        int fd;
+        size_t page;
+        bool operator==(const PageKey &other) const {
+            return fd == other.fd && page == other.page;
+        }
+    } PageKey;
+
+    struct PageKeyHash {
+        size_t operator()(const PageKey &key) const {
+            return std::hash<size_t>()(key.page * 31 + key.fd);
+        }
+    };
+
+    std::mutex lock;
+    size_t page_size;
+    size_t nframes;
+    byte *memory = NULL;
+    std::vector<Frame> frames;
+    std::unordered_map<PageKey, size_t, PageKeyHash> page_table;
+    size_t clock_hand = 0;
+
+    byte *frame_data(size_t frame) const {
+        return memory + frame * page_size;
+    }
+
+    size_t evict_unsafe();
+    void write_back_unsafe(size_t frame);
+
+    public:
+    BufferPool(size_t nframes, size_t page_size = 4096);
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    size_t get_page_size() const {
+        return page_size;
+    }
+
+    // Pinned frame memory holding page of fd, read from disk unless `fresh` (whole page overwritten).
+    // Every pin must be released with unpin.
+    byte *pin(int fd, size_t page, bool fresh = false);
+    void unpin(int fd, size_t page, bool dirty);
+
+    // Write back dirty pages (of fd, or all for fd == -1), sorted and coalesced into pwritev batches
+    void flush(int fd = -1);
+    // Drop all pages of fd; flushes them first
+    void forget(int fd);
+
+    ~BufferPool();
+};
+
+unique_fd open_direct_file(const char *fname, bool readonly, size_t size, size_t page_size, size_t *file_size);
+
+// First page of a DirectBlockStorage file, the data starts at the second page.
+// Files are whole pages long, so the element count is kept here.
+typedef struct DirectFileHeader {
+    uint64_t magic;
+    uint64_t elem_size;
+    uint64_t n;
+} DirectFileHeader;
+
+constexpr static size_t DIRECT_HEADER_PAGES = 1;
+
+void store_direct_header(BufferPool &pool, int fd, size_t elem_size, size_t n);
+// Stored element count; throws unless the file holds a header for at least min_n elements of elem_size
+size_t load_direct_header(BufferPool &pool, int fd, size_t file_size, size_t elem_size, size_t min_n, const char *fname);
+
+// BlockStorage with the same read/write interface, served from O_DIRECT I/O through a BufferPool
+// instead of mmap, so eviction is decided here rather than by the kernel page cache.
+template<class T = byte>
+class DirectBlockStorage {
+    BufferPool *pool;
+    unique_fd fd;
+    std::size_t n = 0;
+    bool readonly;
+
+    template<typename Fcopy>
+    size_t transfer(size_t offset, size_t data_count, bool write, Fcopy &&copy) {
+        data_count = clamp_data_count(offset, data_count, n);
+        auto page_size = pool->get_page_size();
+        auto pos = offset * sizeof(T);
+        auto end = (offset + data_count) * sizeof(T);
+        while (pos < end) {
+            auto page = pos / page_size + DIRECT_HEADER_PAGES;
+            auto page_offset = pos % page_size;
+            auto count = std::min(end - pos, page_size - page_offset);
+            auto frame = pool->pin(fd, page, write && count == page_size);
+            copy(frame + page_offset, pos - offset * sizeof(T), count);
+            pool->unpin(fd, page, write);
+            pos += count;
+        }
+        return data_count;
+    }
+
+    public:
+    size_t get_sizeof() const {
+        return n * sizeof(T);
+    }
+
+    // Opens an existing store, size() is the element count it was created with
+    DirectBlockStorage(BufferPool &pool, const char *fname, bool readonly = true)
+        : pool(&pool), readonly(readonly) {
+        size_t size;
+        fd = open_direct_file(fname, readonly, 0, pool.get_page_size(), &size);
+        n = load_direct_header(pool, fd, size, sizeof(T), 0, fname);
+    }
+
+    // File is rounded up to whole pages (O_DIRECT cannot do partial page I/O) after a header page.
+    // Readonly opens check that the file holds at least n elements.
+    DirectBlockStorage(BufferPool &pool, const char *fname, bool readonly, size_t n)
+        : pool(&pool), n(n), readonly(readonly) {
+        auto page_size = pool.get_page_size();
+        if (readonly) {
+            size_t size;
+            fd = open_direct_file(fname, true, 0, page_size, &size);
+            load_direct_header(pool, fd, size, sizeof(T), n, fname);
+        } else {
+            fd = open_direct_file(fname, false, DIRECT_HEADER_PAGES * page_size + get_sizeof(), page_size, NULL);
+            store_direct_header(pool, fd, sizeof(T), n);
+        }
+    }
+
+    DirectBlockStorage(const DirectBlockStorage&) = delete;
+    DirectBlockStorage& operator=(const DirectBlockStorage&) = delete;
+
+    size_t size() const {
+        return n;
+    }
+
+    size_t read(size_t offset, T *out_data, size_t data_count) {
+        return transfer(offset, data_count, false, [&](const byte *frame, size_t pos, size_t count) {
+            std::copy(frame, frame + count, reinterpret_cast<byte*>(out_data) + pos);
+        });
+    }
+
+    size_t write(size_t offset, const T *in_data, size_t data_count) {
+        if (readonly && clamp_data_count(offset, data_count, n)) {
+            throw std::runtime_error("Cannot write to a readonly DirectBlockStorage instance.");
+        }
+        return transfer(offset, data_count, true, [&](byte *frame, size_t pos, size_t count) {
+            auto in = reinterpret_cast<const byte*>(in_data) + pos;
+            std::copy(in, in + count, frame);
+        });
+    }
+
+    void flush() {
+        pool->flush(fd);
+    }
+
+    void reset() {
+        if (fd.valid()) {
+            pool->forget(fd);
+        }
+        n = 0;
+        fd.reset();
+    }
+
+    ~DirectBlockStorage() {
+        reset();
+    }
+};
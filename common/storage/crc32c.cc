@@ -0,0 +1,142 @@
+#include "crc32c.h"
+
+#include <cstring>
+
+#include <utils/defs.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+constexpr static uint32_t CRC32C_POLY = 0x82F63B78;  // reflected
+
+// Each of the 3 interleaved streams covers this many bytes per round
+constexpr static size_t CRC32C_LANE = 2048;
+
+static struct Crc32cTable {
+    uint32_t table[256];
+
+    Crc32cTable() {
+        for (uint32_t it = 0; it < 256; it++) {
+            uint32_t crc = it;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            table[it] = crc;
+        }
+    }
+} crc32c_table;
+
+// a * b mod P, both in reflected form (bit 31 = x^0)
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^n mod P, reflected
+static uint32_t crc32c_xpowmodp(uint64_t n) {
+    uint32_t result = 1u << 31;  // x^0
+    uint32_t square = 1u << 30;  // x^1
+    while (n) {
+        if (n & 1) {
+            result = crc32c_multmodp(square, result);
+        }
+        square = crc32c_multmodp(square, square);
+        n >>= 1;
+    }
+    return result;
+}
+
+static uint32_t crc32c_sw_raw(uint32_t crc, const byte_t *data, size_t len) {
+    for (size_t it = 0; it < len; it++) {
+        crc = crc32c_table.table[(crc ^ data[it]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void *data, size_t len) {
+    return ~crc32c_sw_raw(~crc, static_cast<const byte_t*>(data), len);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw_raw(uint32_t crc, const byte_t *data, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+    for (; len; len--, data++) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+// crc * x^(8 * shift_bytes) mod P, with k = x^(8 * shift_bytes - 33) mod P precomputed:
+// the carry-less product is reduced by the crc32 instruction, which multiplies by x^32 (+1 from clmul).
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_shift(uint32_t crc, uint32_t k) {
+    auto product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc), _mm_cvtsi32_si128(k), 0);
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+}
+
+// Three independent crc32 chains hide the 3 cycle instruction latency, then get folded together
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_hw_interleaved(uint32_t crc, const byte_t *data, size_t len) {
+    static const uint32_t k1 = crc32c_xpowmodp(8 * CRC32C_LANE - 33);
+    static const uint32_t k2 = crc32c_xpowmodp(16 * CRC32C_LANE - 33);
+
+    for (; len >= 3 * CRC32C_LANE; len -= 3 * CRC32C_LANE, data += 3 * CRC32C_LANE) {
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for (size_t it = 0; it < CRC32C_LANE; it += 8) {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, data + it, 8);
+            memcpy(&word1, data + CRC32C_LANE + it, 8);
+            memcpy(&word2, data + 2 * CRC32C_LANE + it, 8);
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc = crc32c_shift(crc0, k2) ^ crc32c_shift(crc1, k1) ^ (uint32_t)crc2;
+    }
+    return crc32c_hw_raw(crc, data, len);
+}
+
+bool crc32c_hw_available() {
+    static const bool available = __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+    return available;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    if (crc32c_hw_available()) {
+        return ~crc32c_hw_interleaved(~crc, static_cast<const byte_t*>(data), len);
+    }
+    return crc32c_sw(crc, data, len);
+}
+
+#else
+
+bool crc32c_hw_available() {
+    return false;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    return crc32c_sw(crc, data, len);
+}
+
+#endif
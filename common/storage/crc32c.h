@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// CRC32C (Castagnoli), standard pre/post inverted form: crc32c(0, "123456789", 9) == 0xE3069283.
+// Chain calls by passing the previous result as crc.
+// Uses SSE4.2 crc32 with PCLMUL stream combining when the CPU has them, table lookup otherwise.
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_sw(uint32_t crc, const void *data, size_t len);
+bool crc32c_hw_available();
@@ -0,0 +1,216 @@
+#include "hash.h"
+#include "crc32c.h"
+
+#include <cstring>
+
+#include <utils/defs.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+constexpr static uint64_t HASH_SECRET[4] = {
+    0xa0761d6478bd642f, 0xe7037ed1a0b428db, 0x8ebc6af09c88c6e3, 0x589965cc75374cc3
+};
+constexpr static uint32_t HASH_SEED_HI = 0x5bd1e995;
+
+static inline uint64_t read64(const byte_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const byte_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void mum(uint64_t *a, uint64_t *b) {
+    auto r = (unsigned __int128)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t mum_mix(uint64_t a, uint64_t b) {
+    mum(&a, &b);
+    return a ^ b;
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    auto p = static_cast<const byte_t*>(data);
+    seed ^= mum_mix(seed ^ HASH_SECRET[0], HASH_SECRET[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // Overlapping reads cover 4..16 bytes without a loop
+            auto mid = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + mid);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        auto left = len;
+        if (left > 48) {
+            // Three independent multiply chains
+            auto seed1 = seed, seed2 = seed;
+            do {
+                seed = mum_mix(read64(p) ^ HASH_SECRET[1], read64(p + 8) ^ seed);
+                seed1 = mum_mix(read64(p + 16) ^ HASH_SECRET[2], read64(p + 24) ^ seed1);
+                seed2 = mum_mix(read64(p + 32) ^ HASH_SECRET[3], read64(p + 40) ^ seed2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        for (; left > 16; left -= 16, p += 16) {
+            seed = mum_mix(read64(p) ^ HASH_SECRET[1], read64(p + 8) ^ seed);
+        }
+        a = read64(p + left - 16);
+        b = read64(p + left - 8);
+    }
+    a ^= HASH_SECRET[1];
+    b ^= seed;
+    mum(&a, &b);
+    return mum_mix(a ^ HASH_SECRET[0] ^ len, b ^ HASH_SECRET[1]);
+}
+
+// CRC is linear, so the two halves read the value in different bit orders
+// and the multiply-xorshift at the end supplies the non-linearity
+static inline uint64_t hash_u64_finish(uint32_t lo, uint32_t hi) {
+    auto h = (((uint64_t)hi << 32) | lo) * 0x9e3779b97f4a7c15;
+    return h ^ (h >> 29);
+}
+
+// The crc32 instruction without the pre/post inversion
+static inline uint32_t crc32c_u64_sw(uint32_t crc, uint64_t value) {
+    return ~crc32c_sw(~crc, &value, sizeof(value));
+}
+
+static uint64_t hash_u64_sw(uint64_t value, uint64_t seed) {
+    auto lo = crc32c_u64_sw((uint32_t)seed, value);
+    auto hi = crc32c_u64_sw((uint32_t)(seed >> 32) ^ HASH_SEED_HI, (value >> 32) | (value << 32));
+    return hash_u64_finish(lo, hi);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static inline uint64_t hash_u64_hw(uint64_t value, uint64_t seed) {
+    uint32_t lo = _mm_crc32_u64((uint32_t)seed, value);
+    uint32_t hi = _mm_crc32_u64((uint32_t)(seed >> 32) ^ HASH_SEED_HI, (value >> 32) | (value << 32));
+    return hash_u64_finish(lo, hi);
+}
+
+__attribute__((target("sse4.2")))
+static void hash_u64_batch_hw(const uint64_t *values, size_t n, uint64_t *out, uint64_t seed) {
+    // 3 cycle crc32 latency, 1 per cycle throughput - independent keys overlap
+    size_t it = 0;
+    for (; it + 4 <= n; it += 4) {
+        out[it] = hash_u64_hw(values[it], seed);
+        out[it + 1] = hash_u64_hw(values[it + 1], seed);
+        out[it + 2] = hash_u64_hw(values[it + 2], seed);
+        out[it + 3] = hash_u64_hw(values[it + 3], seed);
+    }
+    for (; it < n; it++) {
+        out[it] = hash_u64_hw(values[it], seed);
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void hash_u32_batch_hw(const uint32_t *values, size_t n, uint64_t *out, uint64_t seed) {
+    for (size_t it = 0; it < n; it++) {
+        out[it] = hash_u64_hw(values[it], seed);
+    }
+}
+
+static bool hash_hw_available() {
+    static const bool available = __builtin_cpu_supports("sse4.2");
+    return available;
+}
+
+uint64_t hash_u64(uint64_t value, uint64_t seed) {
+    if (hash_hw_available()) {
+        return hash_u64_hw(value, seed);
+    }
+    return hash_u64_sw(value, seed);
+}
+
+void hash_u64_batch(const uint64_t *values, size_t n, uint64_t *out, uint64_t seed) {
+    if (hash_hw_available()) {
+        hash_u64_batch_hw(values, n, out, seed);
+        return;
+    }
+    for (size_t it = 0; it < n; it++) {
+        out[it] = hash_u64_sw(values[it], seed);
+    }
+}
+
+void hash_u32_batch(const uint32_t *values, size_t n, uint64_t *out, uint64_t seed) {
+    if (hash_hw_available()) {
+        hash_u32_batch_hw(values, n, out, seed);
+        return;
+    }
+    for (size_t it = 0; it < n; it++) {
+        out[it] = hash_u64_sw(values[it], seed);
+    }
+}
+
+#else
+
+uint64_t hash_u64(uint64_t value, uint64_t seed) {
+    return hash_u64_sw(value, seed);
+}
+
+void hash_u64_batch(const uint64_t *values, size_t n, uint64_t *out, uint64_t seed) {
+    for (size_t it = 0; it < n; it++) {
+        out[it] = hash_u64_sw(values[it], seed);
+    }
+}
+
+void hash_u32_batch(const uint32_t *values, size_t n, uint64_t *out, uint64_t seed) {
+    for (size_t it = 0; it < n; it++) {
+        out[it] = hash_u64_sw(values[it], seed);
+    }
+}
+
+#endif
+
+void hash_bytes_batch(const void *data, size_t len, size_t stride, size_t n, uint64_t *out, uint64_t seed) {
+    auto p = static_cast<const byte_t*>(data);
+    for (size_t it = 0; it < n; it++) {
+        out[it] = hash_bytes(p + it * stride, len, seed);
+    }
+}
+
+void hash_bytes_batch(const void *const *keys, const size_t *lens, size_t n, uint64_t *out, uint64_t seed) {
+    for (size_t it = 0; it < n; it++) {
+        out[it] = hash_bytes(keys[it], lens[it], seed);
+    }
+}
+
+hash_t hash_fast(hash_t mod, hash_compute_t value) {
+    return hash_reduce(hash_u64(value), mod);
+}
+
+hash_t hash_fast(hash_t mod, const unsigned char *data, size_t len) {
+    return hash_reduce(hash_bytes(data, len), mod);
+}
+
+hash_t hash_fast(hash_t mod, const hash_t *data, size_t len) {
+    return hash_reduce(hash_bytes(data, len * sizeof(hash_t)), mod);
+}
+
+hash_t hash_fast_set(hash_t mod, const hash_t *data, size_t len) {
+    // Addition commutes, and the per element hashes keep it from cancelling out like a plain sum
+    uint64_t result = 0;
+    for (size_t it = 0; it < len; it++) {
+        result += hash_u64(data[it]);
+    }
+    return hash_reduce(hash_u64(result), mod);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+typedef uint32_t hash_t;
+typedef uint64_t hash_compute_t;
+
+// Hash family for indexes, aggregation and routing. Values are stable across machines
+// and builds (on-disk tables depend on it): integers go through CRC32C, in hardware when
+// the CPU has SSE4.2 and with the table fallback otherwise, bytes through a wyhash style
+// 128-bit multiply mix.
+uint64_t hash_u64(uint64_t value, uint64_t seed = 0);
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed = 0);
+
+// Batch entry points - one dispatch per call, independent keys keep the pipeline full
+void hash_u64_batch(const uint64_t *values, size_t n, uint64_t *out, uint64_t seed = 0);
+void hash_u32_batch(const uint32_t *values, size_t n, uint64_t *out, uint64_t seed = 0);
+// n fixed width keys of len bytes each, `stride` bytes apart (a column chunk or array of structs)
+void hash_bytes_batch(const void *data, size_t len, size_t stride, size_t n, uint64_t *out, uint64_t seed = 0);
+void hash_bytes_batch(const void *const *keys, const size_t *lens, size_t n, uint64_t *out, uint64_t seed = 0);
+
+// Maps a hash to [0, n) without a division (Lemire's multiply-shift reduction)
+inline hash_t hash_reduce(uint64_t hash, hash_t n) {
+    return ((hash >> 32) * n) >> 32;
+}
+
+hash_t hash_fast(hash_t mod, hash_compute_t value);
+hash_t hash_fast(hash_t mod, const unsigned char *data, size_t len);
+hash_t hash_fast(hash_t mod, const hash_t *data, size_t len);
+// Independent of the element order
+hash_t hash_fast_set(hash_t mod, const hash_t *data, size_t len);
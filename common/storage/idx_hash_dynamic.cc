@@ -1,35 +1,80 @@
 #include "idx_hash_dynamic.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-hash_t hash_fast(hash_t mod, hash_compute_t value) {
-    return value % mod;
+
+#if defined(__SSE2__)
+
+uint32_t hash_group_match(const int8_t *ctrl, int8_t h2) {
+    auto group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+uint32_t hash_group_match_empty(const int8_t *ctrl) {
+    return hash_group_match(ctrl, HASH_CTRL_EMPTY);
 }
 
-hash_t hash_fast(hash_t mod, const byte *data, std::size_t len) {
-    hash_compute_t result = 127;
-    for (int it = 0; it < len; it++) {
-        result = (result * 13 + data[it] + 7) % mod;
+uint32_t hash_group_match_free(const int8_t *ctrl) {
+    // Empty and deleted are the only control bytes with the sign bit set
+    return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)));
+}
+
+#else
+
+uint32_t hash_group_match(const int8_t *ctrl, int8_t h2) {
+    uint32_t result = 0;
+    for (std::size_t it = 0; it < HASH_GROUP_SIZE; it++) {
+        result |= (uint32_t)(ctrl[it] == h2) << it;
     }
     return result;
 }
 
-hash_t hash_fast(hash_t mod, const hash_t *data, std::size_t len) {
-    hash_compute_t result = 191;
-    for (int it = 0; it < len; it++) {
-        result = (result * 127) % mod;
-        result = (result + data[it] + it + 7) % mod;
+uint32_t hash_group_match_empty(const int8_t *ctrl) {
+    return hash_group_match(ctrl, HASH_CTRL_EMPTY);
+}
+
+uint32_t hash_group_match_free(const int8_t *ctrl) {
+    uint32_t result = 0;
+    for (std::size_t it = 0; it < HASH_GROUP_SIZE; it++) {
+        result |= (uint32_t)(ctrl[it] < 0) << it;
     }
     return result;
 }
 
-hash_t hash_fast_set(hash_t mod, const hash_t *data, std::size_t len) {
-    hash_compute_t result = 1;
-    for (int it = 0; it < len; it++) {
-        result = (result * data[it]) % mod;
+#endif
+
+uint64_t hash_index_groups(size_t capacity) {
+    auto groups_needed = (capacity * 8 / 7 + HASH_GROUP_SIZE) / HASH_GROUP_SIZE;
+    uint64_t ngroups = 1;
+    while (ngroups < groups_needed) {
+        ngroups <<= 1;
     }
-    return result;
+    return ngroups;
+}
+
+void init_hash_index_header(HashIndexHeader *hdr, uint32_t key_size, uint32_t value_size, uint64_t ngroups) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = HASH_INDEX_MAGIC;
+    hdr->key_size = key_size;
+    hdr->value_size = value_size;
+    hdr->ngroups = ngroups;
 }
 
-void hash_table_append(hash_t hash, ) {
-    //
+void check_hash_index_header(
+    const HashIndexHeader *hdr, uint32_t key_size, uint32_t value_size, size_t file_size, size_t group_size
+) {
+    if (file_size < sizeof(*hdr) || hdr->magic != HASH_INDEX_MAGIC) {
+        throw std::runtime_error("Not a hash index file.");
+    }
+    if (hdr->key_size != key_size || hdr->value_size != value_size) {
+        throw std::runtime_error("Hash index was created with different key or value types.");
+    }
+    if (
+        !hdr->ngroups || (hdr->ngroups & (hdr->ngroups - 1))
+        || file_size < sizeof(*hdr) + hdr->ngroups * group_size
+    ) {
+        throw std::runtime_error("Hash index file is truncated or corrupted.");
+    }
 }
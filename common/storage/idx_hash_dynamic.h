@@ -1,18 +1,280 @@
+#pragma once
+
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
 
-typedef uint8_t byte;
-typedef uint32_t hash_t;
-typedef uint64_t hash_compute_t;
+#include "block.h"
+#include "bloom.h"
+#include "hash.h"
 
 constexpr static std::size_t HASH_POS_NONE = -1;
 
-hash_t hash_fast(hash_t mod, hash_compute_t value);
-hash_t hash_fast(hash_t mod, const byte *data, std::size_t len);
-hash_t hash_fast(hash_t mod, const hash_t *data, std::size_t len);
-hash_t hash_fast_set(hash_t mod, const hash_t *data, std::size_t len);
+// Swiss table control bytes: full slots keep the low 7 bits of the hash (h2)
+constexpr static std::size_t HASH_GROUP_SIZE = 16;
+constexpr static int8_t HASH_CTRL_EMPTY = (int8_t)0x80;
+constexpr static int8_t HASH_CTRL_DELETED = (int8_t)0xfe;
+
+// Bit i set when control byte i of the group matches
+uint32_t hash_group_match(const int8_t *ctrl, int8_t h2);
+uint32_t hash_group_match_empty(const int8_t *ctrl);
+uint32_t hash_group_match_free(const int8_t *ctrl);  // empty or deleted
+
+typedef struct HashIndexHeader {
+    uint64_t magic;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint64_t ngroups;     // power of two
+    uint64_t count;
+    uint64_t tombstones;
+    uint32_t filter_bits_per_key;  // 0 - no bloom filter next to the index
+    byte _pad[20];
+} HashIndexHeader;
+
+constexpr static uint64_t HASH_INDEX_MAGIC = 0x3158444948534148;  // "HASHIDX1"
+
+void init_hash_index_header(HashIndexHeader *hdr, uint32_t key_size, uint32_t value_size, uint64_t ngroups);
+void check_hash_index_header(
+    const HashIndexHeader *hdr, uint32_t key_size, uint32_t value_size, size_t file_size, size_t group_size
+);
+uint64_t hash_index_groups(size_t capacity);
+
+template<class Tkey>
+struct HashKey {
+    uint64_t operator()(const Tkey &key) const {
+        if constexpr (std::is_integral_v<Tkey> && sizeof(Tkey) <= sizeof(uint64_t)) {
+            return hash_u64(key);
+        } else {
+            return hash_bytes(&key, sizeof(key));
+        }
+    }
+};
+
+// Persistent open addressing hash index, Swiss table style.
+// Slots are grouped by 16; one SIMD compare of the group's control bytes against h2
+// finds the candidates, so a lookup usually costs one control word probe plus the line
+// holding the matching slot (a group of 16 slots spans several lines).
+// Keys and values must be trivially copyable, the table lives directly in the mapping.
+template<class Tkey, class Tvalue, class Fhash = HashKey<Tkey>, class Feq = std::equal_to<Tkey>>
+class HashIndex {
+    typedef struct Slot {
+        Tkey key;
+        Tvalue value;
+    } Slot;
+
+    typedef struct Group {
+        int8_t ctrl[HASH_GROUP_SIZE];
+        Slot slots[HASH_GROUP_SIZE];
+    } Group;
+
+    BlockStorage<byte> storage;
+    HashIndexHeader *hdr;
+    Group *groups;
+    Fhash hash;
+    Feq eq;
+    std::unique_ptr<BloomFilter> filter;
+
+    void attach() {
+        hdr = reinterpret_cast<HashIndexHeader*>(storage.mapped());
+        groups = reinterpret_cast<Group*>(storage.mapped() + sizeof(HashIndexHeader));
+    }
+
+    static size_t file_size(uint64_t ngroups) {
+        return sizeof(HashIndexHeader) + ngroups * sizeof(Group);
+    }
+
+    static int8_t get_h2(uint64_t h) {
+        return h & 0x7f;
+    }
+
+    // 7/8 max load, counting tombstones - they lengthen probe chains just the same
+    uint64_t max_used() const {
+        return hdr->ngroups * HASH_GROUP_SIZE / 8 * 7;
+    }
+
+    // Triangular probing over groups visits every group of a power of two table
+    template<typename Fvisit>
+    bool probe(uint64_t h, Fvisit visit) const {
+        auto mask = hdr->ngroups - 1;
+        auto g = (h >> 7) & mask;
+        for (uint64_t step = 1; step <= hdr->ngroups; step++) {
+            if (visit(groups[g])) {
+                return true;
+            }
+            g = (g + step) & mask;
+        }
+        return false;
+    }
+
+    Slot *find_slot(const Tkey &key, uint64_t h) const {
+        auto h2 = get_h2(h);
+        Slot *found = NULL;
+        probe(h, [&](Group &group) {
+            for (auto m = hash_group_match(group.ctrl, h2); m; m &= m - 1) {
+                auto &slot = group.slots[__builtin_ctz(m)];
+                if (eq(slot.key, key)) {
+                    found = &slot;
+                    return true;
+                }
+            }
+            // An empty slot ends every chain that could have passed through this group
+            return hash_group_match_empty(group.ctrl) != 0;
+        });
+        return found;
+    }
+
+    void insert_new(uint64_t h, const Tkey &key, const Tvalue &value) {
+        probe(h, [&](Group &group) {
+            auto m = hash_group_match_free(group.ctrl);
+            if (!m) {
+                return false;
+            }
+            auto pos = __builtin_ctz(m);
+            if (group.ctrl[pos] == HASH_CTRL_DELETED) {
+                hdr->tombstones--;
+            }
+            group.slots[pos].key = key;
+            group.slots[pos].value = value;
+            group.ctrl[pos] = get_h2(h);
+            hdr->count++;
+            return true;
+        });
+    }
+
+    public:
+    // Open an existing index, with its bloom filter if it was created with one
+    HashIndex(const char *fname, bool readonly = true)
+        : storage(fname, readonly) {
+        attach();
+        check_hash_index_header(hdr, sizeof(Tkey), sizeof(Tvalue), storage.size(), sizeof(Group));
+        if (hdr->filter_bits_per_key) {
+            filter = std::make_unique<BloomFilter>(bloom_path(fname).c_str(), readonly);
+        }
+    }
+
+    // Create an empty index with room for `capacity` keys.
+    // With filter_bits_per_key set, lookups of missing keys are mostly answered by a
+    // bloom filter in `<fname>.bloom` without touching the index pages.
+    HashIndex(const char *fname, size_t capacity, unsigned filter_bits_per_key = 0)
+        : storage(fname, false, file_size(hash_index_groups(capacity))) {
+        attach();
+        init_hash_index_header(hdr, sizeof(Tkey), sizeof(Tvalue), hash_index_groups(capacity));
+        for (uint64_t g = 0; g < hdr->ngroups; g++) {
+            memset(groups[g].ctrl, HASH_CTRL_EMPTY, HASH_GROUP_SIZE);
+        }
+        if (filter_bits_per_key) {
+            filter = std::make_unique<BloomFilter>(bloom_path(fname).c_str(), max_used(), filter_bits_per_key);
+            hdr->filter_bits_per_key = filter_bits_per_key;
+        }
+    }
+
+    size_t size() const {
+        return hdr->count;
+    }
+
+    size_t capacity() const {
+        return max_used();
+    }
+
+    bool find(const Tkey &key, Tvalue *out_value = NULL) const {
+        auto h = hash(key);
+        if (filter && !filter->may_contain(h)) {
+            return false;
+        }
+        auto slot = find_slot(key, h);
+        if (slot && out_value) {
+            *out_value = slot->value;
+        }
+        return slot != NULL;
+    }
+
+    // Insert or overwrite, true when the key is new
+    bool insert(const Tkey &key, const Tvalue &value) {
+        auto h = hash(key);
+        if (auto slot = find_slot(key, h)) {
+            slot->value = value;
+            return false;
+        }
+        if (hdr->count + hdr->tombstones >= max_used()) {
+            if (hdr->count >= max_used()) {
+                throw std::runtime_error("Hash index is full.");
+            }
+            compact();
+        }
+        insert_new(h, key, value);
+        if (filter) {
+            filter->add(h);
+        }
+        return true;
+    }
+
+    // Erased keys stay in the bloom filter until the next compact()
+    bool erase(const Tkey &key) {
+        auto slot = find_slot(key, hash(key));
+        if (!slot) {
+            return false;
+        }
+        auto idx = (reinterpret_cast<byte*>(slot) - reinterpret_cast<byte*>(groups)) / sizeof(Group);
+        auto &group = groups[idx];
+        auto pos = slot - group.slots;
+        // No probe chain crosses a group that still has an empty slot, so the slot may go back to empty
+        if (hash_group_match_empty(group.ctrl)) {
+            group.ctrl[pos] = HASH_CTRL_EMPTY;
+        } else {
+            group.ctrl[pos] = HASH_CTRL_DELETED;
+            hdr->tombstones++;
+        }
+        hdr->count--;
+        return true;
+    }
+
+    // Drop tombstones (and stale filter bits) by reinserting all live entries
+    void compact() {
+        std::vector<Slot> live;
+        live.reserve(hdr->count);
+        for (uint64_t g = 0; g < hdr->ngroups; g++) {
+            for (size_t pos = 0; pos < HASH_GROUP_SIZE; pos++) {
+                if (groups[g].ctrl[pos] >= 0) {
+                    live.push_back(groups[g].slots[pos]);
+                }
+            }
+            memset(groups[g].ctrl, HASH_CTRL_EMPTY, HASH_GROUP_SIZE);
+        }
+        hdr->count = 0;
+        hdr->tombstones = 0;
+        if (filter) {
+            filter->clear();
+        }
+        for (auto &slot : live) {
+            auto h = hash(slot.key);
+            insert_new(h, slot.key, slot.value);
+            if (filter) {
+                filter->add(h);
+            }
+        }
+    }
+
+    template<typename Fvisit>
+    void for_each(Fvisit visit) const {
+        for (uint64_t g = 0; g < hdr->ngroups; g++) {
+            for (size_t pos = 0; pos < HASH_GROUP_SIZE; pos++) {
+                if (groups[g].ctrl[pos] >= 0) {
+                    visit(groups[g].slots[pos].key, groups[g].slots[pos].value);
+                }
+            }
+        }
+    }
 
-typedef struct HashNode {
-    std::size_t next;
-    byte data[];
-} HashNode;
+    void sync(bool async = false) {
+        storage.sync(async);
+        if (filter) {
+            filter->sync(async);
+        }
+    }
+};
@@ -0,0 +1,36 @@
+#include "idx_hash_linear.h"
+
+#include <cerrno>
+
+
+constexpr static uint64_t LINEAR_HASH_MAGIC = 0x31534148484e494c;  // "LINHASH1"
+
+std::string init_linear_hash_dir(const std::string &dirname, bool readonly) {
+    if (!readonly && mkdir(dirname.c_str(), S_IRWXU) == -1 && errno != EEXIST) {
+        throw_sys_error("create hash index directory `" + dirname + "`");
+    }
+    return dirname + "/header";
+}
+
+bool check_linear_hash_header(const LinearHashHeader *hdr, uint32_t key_size, uint32_t value_size) {
+    if (hdr->magic == 0) {
+        return false;
+    }
+    if (hdr->magic != LINEAR_HASH_MAGIC) {
+        throw std::runtime_error("Not a linear hash index header.");
+    }
+    if (hdr->key_size != key_size || hdr->value_size != value_size) {
+        throw std::runtime_error("Hash index was created with different key or value types.");
+    }
+    return true;
+}
+
+void init_linear_hash_header(LinearHashHeader *hdr, uint32_t key_size, uint32_t value_size, uint64_t level) {
+    hdr->key_size = key_size;
+    hdr->value_size = value_size;
+    hdr->level = level;
+    hdr->split = 0;
+    hdr->count = 0;
+    hdr->free_page = LINEAR_HASH_NO_PAGE;
+    hdr->magic = LINEAR_HASH_MAGIC;
+}
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <utils/epoch.h>
+
+#include "block_segmented.h"
+#include "idx_hash_dynamic.h"
+
+
+typedef struct LinearHashHeader {
+    uint64_t magic;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint64_t level;      // buckets are addressed with `level` hash bits, one more below `split`
+    uint64_t split;      // next bucket to split
+    uint64_t count;
+    uint64_t free_page;  // head of the overflow page free list
+} LinearHashHeader;
+
+// Page references are overflow page index + 1, so zeroed memory means "no page"
+constexpr static uint64_t LINEAR_HASH_NO_PAGE = 0;
+// Buckets share this many in-memory seqlock versions (bucket & (stripes - 1))
+constexpr static size_t LINEAR_HASH_VERSION_STRIPES = 4096;
+// Retired overflow pages are collected once this many are waiting
+constexpr static size_t LINEAR_HASH_COLLECT_BATCH = 32;
+
+// Creates the index directory when writable, returns the header path
+std::string init_linear_hash_dir(const std::string &dirname, bool readonly);
+// False for a fresh header that still has to be initialized
+bool check_linear_hash_header(const LinearHashHeader *hdr, uint32_t key_size, uint32_t value_size);
+void init_linear_hash_header(LinearHashHeader *hdr, uint32_t key_size, uint32_t value_size, uint64_t level);
+
+// Persistent hash index with linear hashing: the table grows one bucket split per
+// insert instead of rehashing everything at once, so insert latency stays bounded
+// by one bucket chain. Bucket pages and overflow pages live in two segmented
+// storages, which grow in place without moving mapped pages.
+// A page holds 16 slots with Swiss table control bytes, probed with one SIMD compare.
+//
+// One writer thread and any number of reader threads may use an instance at once.
+// find() takes no locks: it validates against seqlock versions (per bucket stripe, plus
+// one for the whole table around splits) and retries when a write overlapped. Overflow
+// pages unlinked by the writer go through epoch reclamation before they are reused,
+// so readers never follow a chain into a page that already belongs to another bucket.
+template<class Tkey, class Tvalue, class Fhash = HashKey<Tkey>, class Feq = std::equal_to<Tkey>>
+class LinearHashIndex {
+    typedef struct Slot {
+        Tkey key;
+        Tvalue value;
+    } Slot;
+
+    typedef struct Page {
+        int8_t ctrl[HASH_GROUP_SIZE];
+        uint64_t next;
+        Slot slots[HASH_GROUP_SIZE];
+    } Page;
+
+    std::string dirname;
+    std::unique_ptr<BlockStorage<LinearHashHeader>> header;
+    LinearHashHeader *hdr;
+    SegmentedBlockStorage<Page> buckets;
+    SegmentedBlockStorage<Page> overflow;
+    Fhash hash;
+    Feq eq;
+
+    std::atomic<uint64_t> table_version = 0;
+    std::unique_ptr<std::atomic<uint32_t>[]> bucket_versions;
+    mutable EpochManager epochs;
+
+    static uint64_t load_relaxed(uint64_t &field) {
+        return std::atomic_ref<uint64_t>(field).load(std::memory_order_relaxed);
+    }
+
+    static void store_relaxed(uint64_t &field, uint64_t value) {
+        std::atomic_ref<uint64_t>(field).store(value, std::memory_order_relaxed);
+    }
+
+    template<class Tversion>
+    static void write_begin(std::atomic<Tversion> &version) {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    template<class Tversion>
+    static void write_end(std::atomic<Tversion> &version) {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    std::atomic<uint32_t> &bucket_version(uint64_t bucket) const {
+        return bucket_versions[bucket & (LINEAR_HASH_VERSION_STRIPES - 1)];
+    }
+
+    static std::unique_ptr<BlockStorage<LinearHashHeader>> open_header(const std::string &dirname, bool readonly) {
+        auto path = init_linear_hash_dir(dirname, readonly);
+        if (readonly) {
+            return std::make_unique<BlockStorage<LinearHashHeader>>(path.c_str(), true);
+        }
+        return std::make_unique<BlockStorage<LinearHashHeader>>(path.c_str(), false, 1);
+    }
+
+    static int8_t get_h2(uint64_t h) {
+        return h & 0x7f;
+    }
+
+    static void init_page(Page *page) {
+        memset(page->ctrl, HASH_CTRL_EMPTY, HASH_GROUP_SIZE);
+        page->next = LINEAR_HASH_NO_PAGE;
+    }
+
+    uint64_t bucket_of(uint64_t h) const {
+        auto bits = h >> 7;
+        auto level = load_relaxed(hdr->level);
+        auto bucket = bits & ((uint64_t(1) << level) - 1);
+        if (bucket < load_relaxed(hdr->split)) {
+            bucket = bits & ((uint64_t(2) << level) - 1);
+        }
+        return bucket;
+    }
+
+    Page *page(uint64_t ref) const {
+        return ref == LINEAR_HASH_NO_PAGE ? NULL : overflow.at(ref - 1);
+    }
+
+    uint64_t alloc_page() {
+        uint64_t ref = hdr->free_page;
+        if (ref != LINEAR_HASH_NO_PAGE) {
+            hdr->free_page = page(ref)->next;
+        } else {
+            ref = overflow.size() + 1;
+            overflow.grow(ref);
+        }
+        init_page(page(ref));
+        return ref;
+    }
+
+    void free_page(uint64_t ref) {
+        page(ref)->next = hdr->free_page;
+        hdr->free_page = ref;
+    }
+
+    // Readers may still be walking the page, it returns to the free list after they leave
+    void retire_page(uint64_t ref) {
+        epochs.retire([this, ref]() { free_page(ref); });
+    }
+
+    // Writer side lookup
+    Slot *find_slot(const Tkey &key, uint64_t h) const {
+        auto h2 = get_h2(h);
+        for (auto p = buckets.at(bucket_of(h)); p; p = page(p->next)) {
+            for (auto m = hash_group_match(p->ctrl, h2); m; m &= m - 1) {
+                auto &slot = p->slots[__builtin_ctz(m)];
+                if (eq(slot.key, key)) {
+                    return &slot;
+                }
+            }
+        }
+        return NULL;
+    }
+
+    // Key must not be in the chain yet
+    void put(uint64_t h, const Tkey &key, const Tvalue &value) {
+        auto p = buckets.at(bucket_of(h));
+        auto m = hash_group_match_free(p->ctrl);
+        while (!m) {
+            if (p->next == LINEAR_HASH_NO_PAGE) {
+                auto ref = alloc_page();
+                store_relaxed(p->next, ref);
+            }
+            p = page(p->next);
+            m = hash_group_match_free(p->ctrl);
+        }
+        auto pos = __builtin_ctz(m);
+        p->slots[pos].key = key;
+        p->slots[pos].value = value;
+        p->ctrl[pos] = get_h2(h);
+    }
+
+    // Reader side chain walk, may see a write in progress: 1 found, 0 missing, -1 torn
+    int read_chain(uint64_t bucket, uint64_t h, const Tkey &key, Tvalue *out_value) const {
+        auto h2 = get_h2(h);
+        auto limit = overflow.size();
+        auto p = buckets.at(bucket);
+        for (size_t hops = 0; ; hops++) {
+            for (auto m = hash_group_match(p->ctrl, h2); m; m &= m - 1) {
+                auto &slot = p->slots[__builtin_ctz(m)];
+                if (eq(slot.key, key)) {
+                    *out_value = slot.value;
+                    return 1;
+                }
+            }
+            auto ref = load_relaxed(p->next);
+            if (ref == LINEAR_HASH_NO_PAGE) {
+                return 0;
+            }
+            if (ref > limit || hops > limit) {
+                return -1;
+            }
+            p = page(ref);
+        }
+    }
+
+    // Split bucket `split` into itself and its buddy at split + 2^level
+    void split_one() {
+        write_begin(table_version);
+        auto from = hdr->split;
+        auto to = from + (uint64_t(1) << hdr->level);
+        buckets.grow(to + 1);
+        init_page(buckets.at(to));
+
+        std::vector<Slot> moved;
+        auto first = buckets.at(from);
+        for (auto p = first; p; p = page(p->next)) {
+            for (size_t pos = 0; pos < HASH_GROUP_SIZE; pos++) {
+                if (p->ctrl[pos] >= 0) {
+                    moved.push_back(p->slots[pos]);
+                }
+            }
+        }
+        for (auto ref = first->next; ref != LINEAR_HASH_NO_PAGE; ref = page(ref)->next) {
+            retire_page(ref);
+        }
+        init_page(first);
+
+        if (from + 1 == (uint64_t(1) << hdr->level)) {
+            store_relaxed(hdr->level, hdr->level + 1);
+            store_relaxed(hdr->split, 0);
+        } else {
+            store_relaxed(hdr->split, from + 1);
+        }
+        for (auto &slot : moved) {
+            put(hash(slot.key), slot.key, slot.value);
+        }
+        write_end(table_version);
+        epochs.collect(LINEAR_HASH_COLLECT_BATCH);
+    }
+
+    public:
+    // Opens the index in dirname, a writable instance creates it with initial_buckets (rounded to 2^k)
+    LinearHashIndex(
+        const char *dirname, bool readonly = true,
+        size_t initial_buckets = 16, unsigned segment_shift = 12
+    ) : dirname(dirname),
+        header(open_header(this->dirname, readonly)),
+        hdr(header->mapped()),
+        buckets((this->dirname + "/buckets").c_str(), readonly, segment_shift),
+        overflow((this->dirname + "/overflow").c_str(), readonly, segment_shift),
+        bucket_versions(new std::atomic<uint32_t>[LINEAR_HASH_VERSION_STRIPES]) {
+        for (size_t it = 0; it < LINEAR_HASH_VERSION_STRIPES; it++) {
+            bucket_versions[it].store(0, std::memory_order_relaxed);
+        }
+        if (!check_linear_hash_header(hdr, sizeof(Tkey), sizeof(Tvalue))) {
+            if (readonly) {
+                throw std::runtime_error("Linear hash index `" + this->dirname + "` is not initialized.");
+            }
+            uint64_t level = 0;
+            while ((uint64_t(1) << level) < initial_buckets) {
+                level++;
+            }
+            buckets.grow(uint64_t(1) << level);
+            for (uint64_t bucket = 0; bucket < buckets.size(); bucket++) {
+                init_page(buckets.at(bucket));
+            }
+            // Header last - a crash before this point leaves a fresh index
+            init_linear_hash_header(hdr, sizeof(Tkey), sizeof(Tvalue), level);
+        }
+    }
+
+    LinearHashIndex(const LinearHashIndex&) = delete;
+    LinearHashIndex &operator=(const LinearHashIndex&) = delete;
+
+    // Readers must be gone by now
+    ~LinearHashIndex() {
+        epochs.collect();
+    }
+
+    size_t size() const {
+        return load_relaxed(hdr->count);
+    }
+
+    size_t bucket_count() const {
+        return (uint64_t(1) << load_relaxed(hdr->level)) + load_relaxed(hdr->split);
+    }
+
+    size_t overflow_pages() const {
+        return overflow.size();
+    }
+
+    // Lock-free, safe to call from any thread while the writer works
+    bool find(const Tkey &key, Tvalue *out_value = NULL) const {
+        auto guard = epochs.enter();
+        auto h = hash(key);
+        for (;;) {
+            auto table_seq = table_version.load(std::memory_order_acquire);
+            if (table_seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            auto bucket = bucket_of(h);
+            if (bucket >= buckets.size()) {
+                continue;
+            }
+            auto &version = bucket_version(bucket);
+            auto bucket_seq = version.load(std::memory_order_acquire);
+            if (bucket_seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            Tvalue value{};
+            auto found = read_chain(bucket, h, key, &value);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (
+                found >= 0
+                && version.load(std::memory_order_relaxed) == bucket_seq
+                && table_version.load(std::memory_order_relaxed) == table_seq
+            ) {
+                if (found && out_value) {
+                    *out_value = value;
+                }
+                return found;
+            }
+        }
+    }
+
+    // Insert or overwrite, true when the key is new. Splits at most one bucket.
+    // Writer only, calls must not overlap.
+    bool insert(const Tkey &key, const Tvalue &value) {
+        auto h = hash(key);
+        auto &version = bucket_version(bucket_of(h));
+        if (auto slot = find_slot(key, h)) {
+            write_begin(version);
+            slot->value = value;
+            write_end(version);
+            return false;
+        }
+        write_begin(version);
+        put(h, key, value);
+        write_end(version);
+        store_relaxed(hdr->count, hdr->count + 1);
+        // 3/4 average page fill keeps most chains at a single page
+        if (hdr->count * 4 > bucket_count() * HASH_GROUP_SIZE * 3) {
+            split_one();
+        }
+        return true;
+    }
+
+    // Writer only
+    bool erase(const Tkey &key) {
+        auto h = hash(key);
+        auto h2 = get_h2(h);
+        auto bucket = bucket_of(h);
+        auto &version = bucket_version(bucket);
+        Page *prev = NULL;
+        for (auto p = buckets.at(bucket); p; prev = p, p = page(p->next)) {
+            for (auto m = hash_group_match(p->ctrl, h2); m; m &= m - 1) {
+                auto pos = __builtin_ctz(m);
+                if (!eq(p->slots[pos].key, key)) {
+                    continue;
+                }
+                // Chains have no probe sequence to keep intact, so no tombstones
+                write_begin(version);
+                p->ctrl[pos] = HASH_CTRL_EMPTY;
+                bool unlink = prev && hash_group_match_empty(p->ctrl) == (1u << HASH_GROUP_SIZE) - 1;
+                auto ref = unlink ? prev->next : LINEAR_HASH_NO_PAGE;
+                if (unlink) {
+                    store_relaxed(prev->next, p->next);
+                }
+                write_end(version);
+                store_relaxed(hdr->count, hdr->count - 1);
+                if (unlink) {
+                    retire_page(ref);
+                    epochs.collect(LINEAR_HASH_COLLECT_BATCH);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Writer thread only, or with no writer around
+    template<typename Fvisit>
+    void for_each(Fvisit visit) const {
+        for (uint64_t bucket = 0; bucket < bucket_count(); bucket++) {
+            for (auto p = buckets.at(bucket); p; p = page(p->next)) {
+                for (size_t pos = 0; pos < HASH_GROUP_SIZE; pos++) {
+                    if (p->ctrl[pos] >= 0) {
+                        visit(p->slots[pos].key, p->slots[pos].value);
+                    }
+                }
+            }
+        }
+    }
+};
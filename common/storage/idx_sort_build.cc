@@ -0,0 +1,42 @@
+#include "idx_sort_build.h"
+
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+unsigned idx_build_threads(unsigned nthreads) {
+    if (nthreads) {
+        return nthreads;
+    }
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void idx_run_threads(unsigned nthreads, const std::function<void(unsigned)> &fn) {
+    std::mutex error_lock;
+    std::exception_ptr error;
+    auto run = [&](unsigned thread_idx) {
+        try {
+            fn(thread_idx);
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(error_lock);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads);
+    for (unsigned thread_idx = 1; thread_idx < nthreads; thread_idx++) {
+        threads.emplace_back(run, thread_idx);
+    }
+    run(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
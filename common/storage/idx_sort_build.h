@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "block.h"
+#include "bloom.h"
+#include "idx_sort_static.h"
+
+
+// Inputs below this are sorted on the calling thread, spawning does not pay off
+constexpr static size_t IDX_BUILD_SERIAL_ITEMS = 1 << 16;
+// Sample sort buckets per thread - threads pick buckets dynamically, so a few
+// extra buckets smooth out uneven splits
+constexpr static size_t IDX_BUILD_BUCKETS_PER_THREAD = 4;
+constexpr static size_t IDX_BUILD_OVERSAMPLE = 64;
+
+// 0 means one thread per core
+unsigned idx_build_threads(unsigned nthreads);
+// Runs fn(thread_idx) for thread_idx in [0, nthreads), the caller being thread 0;
+// rethrows the first exception once all threads joined
+void idx_run_threads(unsigned nthreads, const std::function<void(unsigned)> &fn);
+
+// Sorts in[0, n) into out with a parallel sample sort:
+// splitters from a sorted sample, per thread bucket histograms, a parallel scatter
+// into bucket ranges of out, then every bucket sorted on its own.
+template<class T, class Fless = std::less<T>>
+void sample_sort_parallel(const T *in, T *out, size_t n, unsigned nthreads, Fless less = Fless()) {
+    nthreads = idx_build_threads(nthreads);
+    if (n < IDX_BUILD_SERIAL_ITEMS || nthreads == 1) {
+        std::copy(in, in + n, out);
+        std::sort(out, out + n, less);
+        return;
+    }
+
+    size_t nbuckets = std::min<size_t>(nthreads * IDX_BUILD_BUCKETS_PER_THREAD, UINT16_MAX);
+    size_t nsamples = nbuckets * IDX_BUILD_OVERSAMPLE;
+    std::unique_ptr<T[]> samples(new T[nsamples]);
+    for (size_t it = 0; it < nsamples; it++) {
+        samples[it] = in[it * (n / nsamples)];
+    }
+    std::sort(samples.get(), samples.get() + nsamples, less);
+    std::unique_ptr<T[]> splitters(new T[nbuckets - 1]);
+    for (size_t bucket = 0; bucket < nbuckets - 1; bucket++) {
+        splitters[bucket] = samples[(bucket + 1) * IDX_BUILD_OVERSAMPLE];
+    }
+    auto splitters_end = splitters.get() + nbuckets - 1;
+
+    // Bucket of every item, so the scatter pass does not search the splitters again
+    std::unique_ptr<uint16_t[]> item_buckets(new uint16_t[n]);
+    std::unique_ptr<size_t[]> offsets(new size_t[nthreads * nbuckets]());
+    auto chunk_begin = [&](unsigned thread_idx) { return n * thread_idx / nthreads; };
+
+    idx_run_threads(nthreads, [&](unsigned thread_idx) {
+        auto counts = offsets.get() + thread_idx * nbuckets;
+        for (auto it = chunk_begin(thread_idx); it < chunk_begin(thread_idx + 1); it++) {
+            auto bucket = std::upper_bound(splitters.get(), splitters_end, in[it], less) - splitters.get();
+            item_buckets[it] = bucket;
+            counts[bucket]++;
+        }
+    });
+
+    // Bucket major prefix sum: thread t writes bucket b after threads < t
+    std::unique_ptr<size_t[]> bucket_ends(new size_t[nbuckets]);
+    size_t pos = 0;
+    for (size_t bucket = 0; bucket < nbuckets; bucket++) {
+        for (unsigned thread_idx = 0; thread_idx < nthreads; thread_idx++) {
+            auto &offset = offsets[thread_idx * nbuckets + bucket];
+            auto count = offset;
+            offset = pos;
+            pos += count;
+        }
+        bucket_ends[bucket] = pos;
+    }
+
+    idx_run_threads(nthreads, [&](unsigned thread_idx) {
+        auto thread_offsets = offsets.get() + thread_idx * nbuckets;
+        for (auto it = chunk_begin(thread_idx); it < chunk_begin(thread_idx + 1); it++) {
+            out[thread_offsets[item_buckets[it]]++] = in[it];
+        }
+    });
+
+    std::atomic<size_t> next_bucket = 0;
+    idx_run_threads(nthreads, [&](unsigned) {
+        for (;;) {
+            auto bucket = next_bucket.fetch_add(1);
+            if (bucket >= nbuckets) {
+                break;
+            }
+            auto begin = bucket ? bucket_ends[bucket - 1] : 0;
+            std::sort(out + begin, out + bucket_ends[bucket], less);
+        }
+    });
+}
+
+// Moves sorted[0, n) to their stage positions in index, threads take contiguous sorted ranges
+template<class T>
+void scatter_sort_index(
+    const T *sorted, T *index, size_t n,
+    const size_t *stage_ends, const size_t *stage_size_steps, int nstages, unsigned nthreads
+) {
+    nthreads = idx_build_threads(nthreads);
+    if (n < IDX_BUILD_SERIAL_ITEMS) {
+        nthreads = 1;
+    }
+    idx_run_threads(nthreads, [&](unsigned thread_idx) {
+        auto end = n * (thread_idx + 1) / nthreads;
+        for (auto it = n * thread_idx / nthreads; it < end; it++) {
+            index[get_idx_position(it, stage_ends, stage_size_steps, nstages)] = sorted[it];
+        }
+    });
+}
+
+// Builds the static index of an unsorted column file (raw array of T) into index_fname.
+// Readers recover the layout with compute_stage_ends(n, ...) and the same steps,
+// stage_size_steps[nstages-1] is unused. With filter_bits_per_key a bloom filter of the
+// keys goes to `<index_fname>.bloom` (0 - no filter). Returns the number of keys.
+template<class T, class Fless = std::less<T>, class Fhash = BloomKeyHash<T>>
+size_t build_sort_index_file(
+    const char *column_fname, const char *index_fname,
+    const size_t *stage_size_steps, int nstages, unsigned nthreads = 0,
+    unsigned filter_bits_per_key = BLOOM_BITS_PER_KEY, Fless less = Fless()
+) {
+    static_assert(std::is_trivially_copyable_v<T>, "Index keys are stored as raw bytes.");
+    if (nstages < 1) {
+        throw std::invalid_argument("Static index needs at least one stage.");
+    }
+    for (int stage = 0; stage < nstages - 1; stage++) {
+        if (!stage_size_steps[stage]) {
+            throw std::invalid_argument("Static index stage steps must be positive.");
+        }
+    }
+
+    BlockStorage<T> column(column_fname, true);
+    auto n = column.size();
+    column.advise(AccessMode::SEQUENTIAL);
+    std::unique_ptr<T[]> sorted(new T[n]);
+    sample_sort_parallel(column.mapped(), sorted.get(), n, nthreads, less);
+    column.reset();
+
+    std::unique_ptr<size_t[]> stage_ends(new size_t[nstages]);
+    compute_stage_ends(n, stage_ends.get(), stage_size_steps, nstages);
+    remove_bloom_filter(index_fname);
+    BlockStorage<T> index(index_fname, false, n);
+    scatter_sort_index(sorted.get(), index.mapped(), n, stage_ends.get(), stage_size_steps, nstages, nthreads);
+    index.sync();
+    if (filter_bits_per_key) {
+        build_bloom_filter<T, Fhash>(
+            bloom_path(index_fname).c_str(), std::span<const T>(sorted.get(), n), filter_bits_per_key
+        );
+    }
+    return n;
+}
+
+// Reader of an index written by build_sort_index_file, the steps have to match the build.
+// Point lookups ask the bloom filter first when there is one, so most misses do not touch
+// the index pages.
+template<class T, class Fless = std::less<T>, class Fhash = BloomKeyHash<T>>
+class StaticSortIndex {
+    BlockStorage<T> storage;
+    std::unique_ptr<BloomFilter> filter;
+    std::vector<size_t> stage_size_steps;
+    std::vector<size_t> stage_ends;
+    int nstages;
+    Fless less;
+    Fhash hash;
+
+    public:
+    StaticSortIndex(const char *index_fname, const size_t *stage_size_steps, int nstages, Fless less = Fless())
+        : storage(index_fname, true), filter(open_bloom_filter(index_fname)),
+          stage_size_steps(stage_size_steps, stage_size_steps + std::max(nstages, 0)),
+          stage_ends(std::max(nstages, 0)), nstages(nstages), less(less) {
+        if (nstages < 1) {
+            throw std::invalid_argument("Static index needs at least one stage.");
+        }
+        compute_stage_ends(storage.size(), stage_ends.data(), this->stage_size_steps.data(), nstages);
+    }
+
+    size_t size() const {
+        return storage.size();
+    }
+
+    bool has_filter() const {
+        return filter != nullptr;
+    }
+
+    std::span<const T> keys() const {
+        return std::span<const T>(storage.mapped(), storage.size());
+    }
+
+    // [start, end) positions of the keys in [start_key, end_key], like find_key_range
+    std::tuple<size_t, size_t> find_range(const T &start_key, const T &end_key) const {
+        return find_key_range<T>(
+            keys(), stage_ends.data(), stage_size_steps.data(), nstages, start_key, end_key, less
+        );
+    }
+
+    // Copies of key in the index
+    size_t count(const T &key) const {
+        if (filter && !filter->may_contain(hash(key))) {
+            return 0;
+        }
+        auto [start, end] = find_range(key, key);
+        return end - start;
+    }
+};
@@ -1,6 +1,10 @@
 #include "idx_sort_dynamic.h"
 
 #include <algorithm>
+#include <cerrno>
+
+
+constexpr static uint64_t SORT_INDEX_MAGIC = 0x3154534f49444e49;  // "INDIOST1"
 
 
 Tpos rotate_left(
@@ -26,3 +30,30 @@ Tpos rotate_right(
     left_node->elem_count = all_cnt;
     return up_node_pos;
 }
+
+std::string init_sort_index_dir(const std::string &dirname, bool readonly) {
+    if (!readonly && mkdir(dirname.c_str(), S_IRWXU) == -1 && errno != EEXIST) {
+        throw_sys_error("create sorted index directory `" + dirname + "`");
+    }
+    return dirname + "/header";
+}
+
+bool check_sort_index_header(const SortIndexHeader *hdr, uint64_t elem_size) {
+    if (hdr->magic == 0) {
+        return false;
+    }
+    if (hdr->magic != SORT_INDEX_MAGIC) {
+        throw std::runtime_error("Not a sorted index header.");
+    }
+    if (hdr->elem_size != elem_size) {
+        throw std::runtime_error("Sorted index was created with a different element type.");
+    }
+    return true;
+}
+
+void init_sort_index_header(SortIndexHeader *hdr, uint64_t elem_size) {
+    hdr->elem_size = elem_size;
+    hdr->root = EMPTY;
+    hdr->free_head = EMPTY;
+    hdr->magic = SORT_INDEX_MAGIC;
+}
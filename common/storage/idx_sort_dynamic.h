@@ -1,6 +1,16 @@
+#pragma once
+
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "block_segmented.h"
 
-typedef int8_t byte;
 typedef uint32_t Tpos;
 
 constexpr static Tpos EMPTY = -1;
@@ -20,3 +30,463 @@ Tpos rotate_right(
     IndexNodeHeader *up_node, Tpos up_node_pos,
     IndexNodeHeader *left_node, Tpos left_node_left_count
 );
+
+typedef struct SortIndexHeader {
+    uint64_t magic;
+    uint64_t elem_size;
+    Tpos root;
+    Tpos free_head;  // free nodes are chained through `left`
+} SortIndexHeader;
+
+// Creates the index directory when writable, returns the header path
+std::string init_sort_index_dir(const std::string &dirname, bool readonly);
+// False for a fresh header that still has to be initialized
+bool check_sort_index_header(const SortIndexHeader *hdr, uint64_t elem_size);
+void init_sort_index_header(SortIndexHeader *hdr, uint64_t elem_size);
+
+// Order statistic tree: a weight balanced binary tree whose nodes keep their subtree
+// size in elem_count, so rank / select / range counts are O(log n) walks.
+// Nodes come from a pool in a segmented storage, freed nodes are reused first.
+// Elements are trivially copyable records ordered by Fless; equal elements are allowed.
+template<class T, class Fless = std::less<T>>
+class OrderStatTree {
+    constexpr static size_t NODE_SIZE = (sizeof(IndexNodeHeader) + sizeof(T) + 3) & ~size_t(3);
+    // Rebalance when one side outweighs the other delta times, double rotation below ratio
+    constexpr static Tpos DELTA = 3;
+    constexpr static Tpos RATIO = 2;
+
+    typedef struct Node {
+        byte raw[NODE_SIZE];
+    } Node;
+
+    std::string dirname;
+    std::unique_ptr<BlockStorage<SortIndexHeader>> header;
+    SortIndexHeader *hdr;
+    SegmentedBlockStorage<Node> nodes;
+    Fless less;
+
+    static std::unique_ptr<BlockStorage<SortIndexHeader>> open_header(const std::string &dirname, bool readonly) {
+        auto path = init_sort_index_dir(dirname, readonly);
+        if (readonly) {
+            return std::make_unique<BlockStorage<SortIndexHeader>>(path.c_str(), true);
+        }
+        return std::make_unique<BlockStorage<SortIndexHeader>>(path.c_str(), false, 1);
+    }
+
+    IndexNodeHeader *node(Tpos pos) const {
+        return reinterpret_cast<IndexNodeHeader*>(nodes.at(pos));
+    }
+
+    // Node data is only 4 byte aligned
+    T elem(Tpos pos) const {
+        T value;
+        memcpy(&value, node(pos)->data, sizeof(T));
+        return value;
+    }
+
+    Tpos count(Tpos pos) const {
+        return pos == EMPTY ? 0 : node(pos)->elem_count;
+    }
+
+    Tpos alloc_node(const T &value) {
+        Tpos pos = hdr->free_head;
+        if (pos != EMPTY) {
+            hdr->free_head = node(pos)->left;
+        } else {
+            if (nodes.size() >= EMPTY) {
+                throw std::runtime_error("Sorted index `" + dirname + "` is out of node positions.");
+            }
+            pos = nodes.size();
+            nodes.grow(pos + 1);
+        }
+        auto n = node(pos);
+        *n = IndexNodeHeader();
+        memcpy(n->data, &value, sizeof(T));
+        return pos;
+    }
+
+    void free_node(Tpos pos) {
+        node(pos)->left = hdr->free_head;
+        hdr->free_head = pos;
+    }
+
+    // Subtree root at pos with correct counts, children balanced - returns the new root
+    Tpos balance(Tpos pos) {
+        auto n = node(pos);
+        auto wl = count(n->left) + 1;
+        auto wr = count(n->right) + 1;
+        if (wr > DELTA * wl) {
+            auto rpos = n->right;
+            auto r = node(rpos);
+            if (count(r->left) + 1 >= RATIO * (count(r->right) + 1)) {
+                auto rl = node(r->left);
+                n->right = rotate_right(r, rpos, rl, count(rl->left));
+                r = rl;
+            }
+            return rotate_left(n, pos, r, count(r->right));
+        }
+        if (wl > DELTA * wr) {
+            auto lpos = n->left;
+            auto l = node(lpos);
+            if (count(l->right) + 1 >= RATIO * (count(l->left) + 1)) {
+                auto lr = node(l->right);
+                n->left = rotate_left(l, lpos, lr, count(lr->right));
+                l = lr;
+            }
+            return rotate_right(n, pos, l, count(l->left));
+        }
+        return pos;
+    }
+
+    Tpos insert_at(Tpos pos, Tpos new_pos, const T &value) {
+        if (pos == EMPTY) {
+            return new_pos;
+        }
+        auto n = node(pos);
+        n->elem_count++;
+        if (less(value, elem(pos))) {
+            n->left = insert_at(n->left, new_pos, value);
+        } else {
+            n->right = insert_at(n->right, new_pos, value);
+        }
+        return balance(pos);
+    }
+
+    Tpos extract_min(Tpos pos, Tpos *min_pos) {
+        auto n = node(pos);
+        if (n->left == EMPTY) {
+            *min_pos = pos;
+            return n->right;
+        }
+        n->elem_count--;
+        n->left = extract_min(n->left, min_pos);
+        return balance(pos);
+    }
+
+    Tpos erase_at(Tpos pos, const T &value, bool *found) {
+        if (pos == EMPTY) {
+            return EMPTY;
+        }
+        auto n = node(pos);
+        auto current = elem(pos);
+        if (less(value, current)) {
+            n->left = erase_at(n->left, value, found);
+        } else if (less(current, value)) {
+            n->right = erase_at(n->right, value, found);
+        } else {
+            *found = true;
+            auto left = n->left, right = n->right;
+            free_node(pos);
+            if (left == EMPTY) {
+                return right;
+            }
+            if (right == EMPTY) {
+                return left;
+            }
+            // Successor takes the place of the removed node
+            Tpos succ;
+            right = extract_min(right, &succ);
+            auto s = node(succ);
+            s->left = left;
+            s->right = right;
+            s->elem_count = count(left) + count(right) + 1;
+            return balance(succ);
+        }
+        if (*found) {
+            n->elem_count--;
+        }
+        return balance(pos);
+    }
+
+    // Number of elements e with less(e, value), or with !less(value, e) when inclusive
+    size_t rank_at(const T &value, bool inclusive) const {
+        size_t result = 0;
+        for (auto pos = hdr->root; pos != EMPTY; ) {
+            auto n = node(pos);
+            auto current = elem(pos);
+            bool go_right = inclusive ? !less(value, current) : less(current, value);
+            if (go_right) {
+                result += count(n->left) + 1;
+                pos = n->right;
+            } else {
+                pos = n->left;
+            }
+        }
+        return result;
+    }
+
+    // Perfectly balanced subtree over in-order indexes [lo, hi), node of index i at base + i.
+    // Nodes are written in position order, so the build is one sequential pass.
+    template<typename Fnext>
+    Tpos build_at(size_t lo, size_t hi, Tpos base, Fnext &next) {
+        if (lo >= hi) {
+            return EMPTY;
+        }
+        auto mid = lo + (hi - lo) / 2;
+        auto left = build_at(lo, mid, base, next);
+        Tpos pos = base + mid;
+        auto n = node(pos);
+        n->left = left;
+        n->elem_count = hi - lo;
+        auto value = next();
+        memcpy(n->data, &value, sizeof(T));
+        n->right = build_at(mid + 1, hi, base, next);
+        return pos;
+    }
+
+    // Same shape over existing nodes, only links and counts are rewritten
+    Tpos link_at(size_t lo, size_t hi, const std::vector<Tpos> &order) {
+        if (lo >= hi) {
+            return EMPTY;
+        }
+        auto mid = lo + (hi - lo) / 2;
+        auto n = node(order[mid]);
+        n->left = link_at(lo, mid, order);
+        n->right = link_at(mid + 1, hi, order);
+        n->elem_count = hi - lo;
+        return order[mid];
+    }
+
+    void check_sorted(const T &prev, const T &value, size_t it) const {
+        if (it && less(value, prev)) {
+            throw std::runtime_error("Bulk input for a sorted index is not sorted.");
+        }
+    }
+
+    public:
+    OrderStatTree(const char *dirname, bool readonly = true, unsigned segment_shift = 16)
+        : dirname(dirname),
+          header(open_header(this->dirname, readonly)),
+          hdr(header->mapped()),
+          nodes((this->dirname + "/nodes").c_str(), readonly, segment_shift) {
+        if (!check_sort_index_header(hdr, sizeof(T))) {
+            if (readonly) {
+                throw std::runtime_error("Sorted index `" + this->dirname + "` is not initialized.");
+            }
+            init_sort_index_header(hdr, sizeof(T));
+        }
+    }
+
+    size_t size() const {
+        return count(hdr->root);
+    }
+
+    void insert(const T &value) {
+        auto new_pos = alloc_node(value);
+        hdr->root = insert_at(hdr->root, new_pos, value);
+    }
+
+    // Removes one element equal to value
+    bool erase(const T &value) {
+        bool found = false;
+        hdr->root = erase_at(hdr->root, value, &found);
+        return found;
+    }
+
+    // Builds the tree from n elements read once, in order, from first.
+    // The tree must be empty; nodes are laid out in key order at the start of the pool.
+    template<class Iter>
+    void bulk_load(Iter first, size_t n) {
+        if (hdr->root != EMPTY) {
+            throw std::runtime_error("Bulk load into a non-empty sorted index `" + dirname + "`.");
+        }
+        if (n >= EMPTY) {
+            throw std::runtime_error("Sorted index `" + dirname + "` is out of node positions.");
+        }
+        // Every pooled node is free, so the pool restarts from position 0
+        auto pool_size = nodes.size();
+        if (pool_size < n) {
+            nodes.grow(n);
+        }
+        hdr->free_head = EMPTY;
+        for (auto pos = pool_size; pos > n; pos--) {
+            free_node(pos - 1);
+        }
+
+        size_t it = 0;
+        T prev{};
+        auto next = [&]() {
+            T value = *first;
+            ++first;
+            check_sorted(prev, value, it++);
+            prev = value;
+            return value;
+        };
+        try {
+            hdr->root = build_at(0, n, 0, next);
+        } catch (...) {
+            // The tree stays empty, the whole pool goes back to the free list
+            hdr->free_head = EMPTY;
+            for (auto pos = nodes.size(); pos > 0; pos--) {
+                free_node(pos - 1);
+            }
+            throw;
+        }
+    }
+
+    // Folds m sorted elements into the tree. A large batch relinks the whole merged
+    // sequence into a balanced shape (O(n + m), no element moves); a small one is
+    // inserted element by element, whichever does less work (m log n vs n + m).
+    // Unsorted input throws and leaves the tree unchanged.
+    template<class Iter>
+    void merge(Iter first, size_t m) {
+        auto n = size();
+        if (!n) {
+            bulk_load(first, m);
+            return;
+        }
+        if (m * std::log2(n + 1) <= n + m) {
+            // The batch is small, it is checked whole before the first insert
+            std::vector<T> values;
+            values.reserve(m);
+            T prev{};
+            for (size_t it = 0; it < m; it++, ++first) {
+                T value = *first;
+                check_sorted(prev, value, it);
+                prev = value;
+                values.push_back(value);
+            }
+            for (auto &value : values) {
+                insert(value);
+            }
+            return;
+        }
+
+        std::vector<Tpos> order;
+        order.reserve(n + m);
+        std::vector<Tpos> stack;
+        std::vector<Tpos> added;
+        added.reserve(m);
+        auto pos = hdr->root;
+        T prev{};
+        try {
+            for (size_t it = 0; it < m; it++, ++first) {
+                T value = *first;
+                check_sorted(prev, value, it);
+                prev = value;
+                // Old elements not after value go first - equal ones keep insertion order
+                while (pos != EMPTY || !stack.empty()) {
+                    if (pos != EMPTY) {
+                        stack.push_back(pos);
+                        pos = node(pos)->left;
+                        continue;
+                    }
+                    auto top = stack.back();
+                    if (less(value, elem(top))) {
+                        break;
+                    }
+                    stack.pop_back();
+                    order.push_back(top);
+                    pos = node(top)->right;
+                }
+                added.push_back(alloc_node(value));
+                order.push_back(added.back());
+            }
+        } catch (...) {
+            // Old nodes are not relinked yet, only the new ones have to go
+            for (auto added_pos : added) {
+                free_node(added_pos);
+            }
+            throw;
+        }
+        while (pos != EMPTY || !stack.empty()) {
+            if (pos != EMPTY) {
+                stack.push_back(pos);
+                pos = node(pos)->left;
+            } else {
+                order.push_back(stack.back());
+                pos = node(stack.back())->right;
+                stack.pop_back();
+            }
+        }
+        hdr->root = link_at(0, order.size(), order);
+    }
+
+    // Elements ordered before value
+    size_t rank(const T &value) const {
+        return rank_at(value, false);
+    }
+
+    // k-th smallest element, 0 based
+    bool select(size_t k, T *out_value) const {
+        for (auto pos = hdr->root; pos != EMPTY; ) {
+            auto n = node(pos);
+            auto left_count = count(n->left);
+            if (k < left_count) {
+                pos = n->left;
+            } else if (k == left_count) {
+                *out_value = elem(pos);
+                return true;
+            } else {
+                k -= left_count + 1;
+                pos = n->right;
+            }
+        }
+        return false;
+    }
+
+    // First element not ordered before value
+    bool lower_bound(const T &value, T *out_value) const {
+        bool found = false;
+        for (auto pos = hdr->root; pos != EMPTY; ) {
+            auto current = elem(pos);
+            if (less(current, value)) {
+                pos = node(pos)->right;
+            } else {
+                *out_value = current;
+                found = true;
+                pos = node(pos)->left;
+            }
+        }
+        return found;
+    }
+
+    // Elements in [start, end], both ends inclusive like find_idx_range
+    size_t range_count(const T &start, const T &end) const {
+        auto hi = rank_at(end, true);
+        auto lo = rank_at(start, false);
+        return hi > lo ? hi - lo : 0;
+    }
+
+    // In order walk
+    template<typename Fvisit>
+    void for_each(Fvisit visit) const {
+        std::vector<Tpos> stack;
+        for (auto pos = hdr->root; pos != EMPTY || !stack.empty(); ) {
+            if (pos != EMPTY) {
+                stack.push_back(pos);
+                pos = node(pos)->left;
+            } else {
+                pos = stack.back();
+                stack.pop_back();
+                visit(elem(pos));
+                pos = node(pos)->right;
+            }
+        }
+    }
+
+    // In order walk over the elements in [start, end], subtrees outside are skipped
+    template<typename Fvisit>
+    void for_each_range(const T &start, const T &end, Fvisit visit) const {
+        std::vector<Tpos> stack;
+        for (auto pos = hdr->root; pos != EMPTY || !stack.empty(); ) {
+            if (pos != EMPTY) {
+                if (less(elem(pos), start)) {
+                    pos = node(pos)->right;
+                } else {
+                    stack.push_back(pos);
+                    pos = node(pos)->left;
+                }
+            } else {
+                pos = stack.back();
+                stack.pop_back();
+                auto current = elem(pos);
+                if (less(end, current)) {
+                    break;
+                }
+                visit(current);
+                pos = node(pos)->right;
+            }
+        }
+    }
+};
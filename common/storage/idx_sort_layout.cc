@@ -0,0 +1,36 @@
+#include "idx_sort_layout.h"
+
+#include <stdexcept>
+
+
+StagedLayout::StagedLayout(size_t n, size_t step, size_t top_items) : n(n) {
+    nstages = idx_stage_layout(n, step, top_items, stage_size_steps, IDX_LAYOUT_MAX_STAGES);
+    compute_stage_ends(n, stage_ends, stage_size_steps, nstages);
+}
+
+size_t EytzingerLayout::rank(size_t k) const {
+    // Rank in the perfect tree with a full last level, then drop the missing last level
+    // nodes before it - in the perfect tree last level node p sits at rank 2p
+    int height = 63 - __builtin_clzll(n);
+    int depth = 63 - __builtin_clzll(k);
+    size_t full_rank = ((2 * (k - (size_t(1) << depth)) + 1) << (height - depth)) - 1;
+    size_t leaves = n - (size_t(1) << height) + 1;
+    size_t leaves_before = (full_rank + 1) / 2;
+    return full_rank - (leaves_before > leaves ? leaves_before - leaves : 0);
+}
+
+StreeLayout::StreeLayout(size_t n, size_t node_items) : n(n), node_items(node_items) {
+    if (node_items < 2) {
+        throw std::invalid_argument("S+ tree nodes need at least two keys.");
+    }
+    nlayers = 1;
+    blocks[0] = (n + node_items - 1) / node_items;
+    offsets[0] = 0;
+    total = blocks[0] * node_items;
+    while (blocks[nlayers - 1] > 1) {
+        blocks[nlayers] = (blocks[nlayers - 1] + node_items) / (node_items + 1);
+        offsets[nlayers] = total;
+        total += blocks[nlayers] * node_items;
+        nlayers++;
+    }
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+
+#include "idx_sort_static.h"
+
+
+// Alternative static layouts of a sorted array, all with the same interface:
+//   size()                          items of storage the layout needs
+//   build(out, sorted)              fills out, sorted(i) returns the i-th smallest key
+//   find_key_range(data, s, e, less) -> [start, end) sorted positions of keys in [s, e]
+// so callers and benchmarks pick one by template parameter.
+
+constexpr static int IDX_LAYOUT_MAX_STAGES = 8;
+constexpr static int IDX_STREE_MAX_LAYERS = 48;
+
+// Keys per cache line, the node size of the block layouts
+template<class T>
+constexpr size_t idx_line_items() {
+    return std::max<size_t>(64 / sizeof(T), 1);
+}
+
+// The stage layout of idx_sort_static: every step+1-th key lifted a stage up
+struct StagedLayout {
+    size_t n;
+    int nstages;
+    size_t stage_size_steps[IDX_LAYOUT_MAX_STAGES];
+    size_t stage_ends[IDX_LAYOUT_MAX_STAGES];
+
+    // top_items >= n gives a single stage - plain binary search over the sorted array
+    StagedLayout(size_t n, size_t step, size_t top_items = 4096);
+
+    size_t size() const {
+        return n;
+    }
+
+    template<class T, class Fsorted>
+    void build(T *out, Fsorted sorted) const {
+        for (size_t it = 0; it < n; it++) {
+            out[get_idx_position(it, stage_ends, stage_size_steps, nstages)] = sorted(it);
+        }
+    }
+
+    template<class T, class Fless = std::less<T>>
+    std::tuple<size_t, size_t> find_key_range(
+        const T *data, const T &start_key, const T &end_key, Fless &&less = Fless()
+    ) const {
+        return ::find_key_range<T>(
+            std::span<const T>(data, n), stage_ends, stage_size_steps, nstages, start_key, end_key, less
+        );
+    }
+};
+
+// Eytzinger (BFS) order: node k at out[k] (1 based, slot 0 unused), children at 2k and 2k+1.
+// The search is a branchless descent; the 4 (int32) / 3 (int64) levels below the current
+// node share a cache line, prefetched before it is needed.
+struct EytzingerLayout {
+    size_t n;
+
+    EytzingerLayout(size_t n) : n(n) {}
+
+    size_t size() const {
+        return n + 1;
+    }
+
+    // Sorted position of node k
+    size_t rank(size_t k) const;
+
+    template<class T, class Fsorted>
+    void build(T *out, Fsorted sorted) const {
+        if (!n) {
+            return;
+        }
+        // In order walk of the implicit tree, starting at the leftmost node
+        size_t k = 1;
+        while (2 * k <= n) {
+            k = 2 * k;
+        }
+        for (size_t it = 0; it < n; it++) {
+            out[k] = sorted(it);
+            if (2 * k + 1 <= n) {
+                k = 2 * k + 1;
+                while (2 * k <= n) {
+                    k = 2 * k;
+                }
+            } else {
+                while (k & 1) {
+                    k >>= 1;
+                }
+                k >>= 1;
+            }
+        }
+    }
+
+    // Keys for which pred(k) holds (a prefix in sorted order)
+    template<class T, typename Fpred>
+    size_t count(const T *data, Fpred &&pred) const {
+        size_t k = 1;
+        while (k <= n) {
+            __builtin_prefetch(data + k * idx_line_items<T>());
+            k = 2 * k + pred(k);
+        }
+        // Undo the right turns taken after the last left one, that node is the answer
+        k >>= __builtin_ffsll(~k);
+        return k ? rank(k) : n;
+    }
+
+    template<class T, class Fless = std::less<T>>
+    std::tuple<size_t, size_t> find_key_range(
+        const T *data, const T &start_key, const T &end_key, Fless &&less = Fless()
+    ) const {
+        return std::make_tuple(
+            count(data, [&](size_t k) { return less(data[k], start_key); }),
+            count(data, [&](size_t k) { return !less(end_key, data[k]); })
+        );
+    }
+};
+
+// S+ tree: the sorted array is the bottom layer, cut in nodes of node_items keys. Every layer
+// above holds, per node, the first keys of children 1..node_items of the node_items+1 children
+// below it, so a node is one cache line and the search reads one line per layer.
+// The in-node search is the same window count as the stage layout (SIMD for plain keys).
+struct StreeLayout {
+    size_t n;
+    size_t node_items;
+    int nlayers;
+    size_t blocks[IDX_STREE_MAX_LAYERS];   // nodes per layer, layer 0 at the bottom
+    size_t offsets[IDX_STREE_MAX_LAYERS];  // layer starts, multiples of node_items
+    size_t total;
+
+    StreeLayout(size_t n, size_t node_items);
+
+    size_t size() const {
+        return total;
+    }
+
+    template<class T, class Fsorted>
+    void build(T *out, Fsorted sorted) const {
+        for (size_t it = 0; it < n; it++) {
+            out[it] = sorted(it);
+        }
+        // Leftmost bottom node below node c of layer h is c * (node_items+1)^h
+        size_t subtree_nodes = 1;
+        for (int layer = 1; layer < nlayers; layer++) {
+            for (size_t node = 0; node < blocks[layer]; node++) {
+                for (size_t it = 0; it < node_items; it++) {
+                    auto child = node * (node_items + 1) + it + 1;
+                    if (child < blocks[layer - 1]) {
+                        out[offsets[layer] + node * node_items + it] = sorted(child * subtree_nodes * node_items);
+                    }
+                }
+            }
+            subtree_nodes *= node_items + 1;
+        }
+    }
+
+    // Keys for which pred holds, count_window(begin, end) counts them in out[begin, end)
+    template<typename Fcount_window>
+    size_t count(Fcount_window &&count_window) const {
+        size_t node = 0;
+        for (int layer = nlayers - 1; layer >= 1; layer--) {
+            auto begin = offsets[layer] + node * node_items;
+            auto nchildren = std::min(node_items + 1, blocks[layer - 1] - node * (node_items + 1));
+            node = node * (node_items + 1) + (nchildren > 1 ? count_window(begin, begin + nchildren - 1) : 0);
+        }
+        auto begin = node * node_items;
+        auto end = std::min(begin + node_items, n);
+        return begin + (begin < end ? count_window(begin, end) : 0);
+    }
+
+    template<class T, class Fless = std::less<T>>
+    std::tuple<size_t, size_t> find_key_range(
+        const T *data, const T &start_key, const T &end_key, Fless &&less = Fless()
+    ) const {
+        if constexpr (idx_simd_key<T> && std::is_same_v<std::decay_t<Fless>, std::less<T>>) {
+            return std::make_tuple(
+                count([&](size_t begin, size_t end) { return idx_count_less(data + begin, end - begin, start_key); }),
+                count([&](size_t begin, size_t end) { return idx_count_less_equal(data + begin, end - begin, end_key); })
+            );
+        } else {
+            auto count_if = [&](auto &&pred) {
+                return count([&](size_t begin, size_t end) {
+                    size_t count = 0;
+                    for (auto it = begin; it < end; it++) {
+                        count += pred(data[it]);
+                    }
+                    return count;
+                });
+            };
+            return std::make_tuple(
+                count_if([&](const T &key) { return less(key, start_key); }),
+                count_if([&](const T &key) { return !less(end_key, key); })
+            );
+        }
+    }
+};
@@ -0,0 +1,154 @@
+#include "idx_sort_lsm.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+
+
+constexpr static uint64_t LSM_MAGIC = 0x314d53494e49ULL;  // "INISM1"
+
+std::string init_lsm_dir(const std::string &dirname, bool readonly) {
+    if (!readonly && mkdir(dirname.c_str(), S_IRWXU) == -1 && errno != EEXIST) {
+        throw_sys_error("create lsm index directory `" + dirname + "`");
+    }
+    return dirname + "/manifest";
+}
+
+std::string lsm_mem_path(const std::string &dirname, uint64_t id) {
+    char name[32];
+    snprintf(name, sizeof(name), "/mem_%08lu", (unsigned long)id);
+    return dirname + name;
+}
+
+std::string lsm_run_path(const std::string &dirname, uint64_t id) {
+    char name[32];
+    snprintf(name, sizeof(name), "/run_%08lu", (unsigned long)id);
+    return dirname + name;
+}
+
+bool read_lsm_manifest(const std::string &path, LsmManifestHeader *hdr, std::vector<uint64_t> *run_ids) {
+    unique_fd fd = open(path.c_str(), O_RDONLY);
+    if (!fd.valid()) {
+        if (errno == ENOENT) {
+            return false;
+        }
+        throw_sys_error("open lsm manifest `" + path + "`");
+    }
+    if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) || hdr->magic != LSM_MAGIC) {
+        throw std::runtime_error("Invalid lsm manifest `" + path + "`.");
+    }
+    run_ids->resize(hdr->nruns);
+    auto ids_size = hdr->nruns * sizeof(uint64_t);
+    if (pread(fd, run_ids->data(), ids_size, sizeof(*hdr)) != (ssize_t)ids_size) {
+        throw std::runtime_error("Lsm manifest `" + path + "` is truncated.");
+    }
+    return true;
+}
+
+void write_lsm_manifest(const std::string &path, LsmManifestHeader hdr, const std::vector<uint64_t> &run_ids) {
+    hdr.magic = LSM_MAGIC;
+    hdr.nruns = run_ids.size();
+    std::vector<byte> data(sizeof(hdr) + run_ids.size() * sizeof(uint64_t));
+    memcpy(data.data(), &hdr, sizeof(hdr));
+    // An empty vector may have a NULL data(), which memcpy must not get
+    if (!run_ids.empty()) {
+        memcpy(data.data() + sizeof(hdr), run_ids.data(), run_ids.size() * sizeof(uint64_t));
+    }
+
+    auto tmp_path = path + ".tmp";
+    {
+        unique_fd fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (!fd.valid()) {
+            throw_sys_error("open lsm manifest `" + tmp_path + "`");
+        }
+        if (write(fd, data.data(), data.size()) != (ssize_t)data.size()) {
+            throw_sys_error("write lsm manifest `" + tmp_path + "`");
+        }
+        if (fsync(fd) == -1) {
+            throw_sys_error("fsync lsm manifest `" + tmp_path + "`");
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) == -1) {
+        throw_sys_error("rename lsm manifest `" + tmp_path + "`");
+    }
+    // The rename (and the entries of the run files it lists) is durable once the directory is
+    auto dirname = std::filesystem::path(path).parent_path().string();
+    unique_fd dir_fd = open(dirname.empty() ? "." : dirname.c_str(), O_RDONLY | O_DIRECTORY);
+    if (!dir_fd.valid()) {
+        throw_sys_error("open lsm index directory `" + dirname + "`");
+    }
+    if (fsync(dir_fd) == -1) {
+        throw_sys_error("fsync lsm index directory `" + dirname + "`");
+    }
+}
+
+void remove_lsm_path(const std::string &path) {
+    std::error_code err;
+    std::filesystem::remove_all(path, err);
+    if (err) {
+        throw std::runtime_error("Cannot remove `" + path + "`: " + err.message());
+    }
+}
+
+int lsm_run_layout(size_t n, size_t *stage_size_steps) {
+    return idx_stage_layout(n, LSM_RUN_STEP, LSM_TOP_STAGE_ITEMS, stage_size_steps, LSM_MAX_STAGES);
+}
+
+void IndexWorkerPool::worker_loop() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        cv.wait(guard, [&]() { return !running || !tasks.empty(); });
+        if (!running) {
+            return;
+        }
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        busy++;
+        guard.unlock();
+        task();
+        guard.lock();
+        busy--;
+        if (tasks.empty() && !busy) {
+            idle_cv.notify_all();
+        }
+    }
+}
+
+void IndexWorkerPool::start(unsigned nthreads) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (running) {
+        return;
+    }
+    running = true;
+    for (unsigned it = 0; it < nthreads; it++) {
+        threads.emplace_back(&IndexWorkerPool::worker_loop, this);
+    }
+}
+
+void IndexWorkerPool::push(std::function<void()> task) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running) {
+        return;
+    }
+    tasks.push_back(std::move(task));
+    cv.notify_one();
+}
+
+void IndexWorkerPool::wait_idle() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle_cv.wait(guard, [&]() { return !running || (tasks.empty() && !busy); });
+}
+
+void IndexWorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+        tasks.clear();
+    }
+    cv.notify_all();
+    idle_cv.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
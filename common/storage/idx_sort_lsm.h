@@ -0,0 +1,513 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "block.h"
+#include "bloom.h"
+#include "idx_sort_build.h"
+#include "idx_sort_dynamic.h"
+#include "idx_sort_static.h"
+
+
+typedef struct LsmManifestHeader {
+    uint64_t magic;
+    uint64_t next_id;     // ids are shared by memtables and runs
+    uint64_t active_mem;
+    uint64_t frozen_mem;  // memtable being flushed, 0 when none
+    uint64_t nruns;       // followed by nruns run ids
+} LsmManifestHeader;
+
+// Runs get stages of this step until the top stage is small enough to stay cached
+constexpr static size_t LSM_RUN_STEP = 32;
+constexpr static size_t LSM_TOP_STAGE_ITEMS = 4096;
+constexpr static int LSM_MAX_STAGES = 8;
+
+// Creates the index directory when writable, returns the manifest path
+std::string init_lsm_dir(const std::string &dirname, bool readonly);
+std::string lsm_mem_path(const std::string &dirname, uint64_t id);
+std::string lsm_run_path(const std::string &dirname, uint64_t id);
+// False when there is no manifest yet
+bool read_lsm_manifest(const std::string &path, LsmManifestHeader *hdr, std::vector<uint64_t> *run_ids);
+// Replaces the manifest atomically (temporary file + rename + directory fsync)
+void write_lsm_manifest(const std::string &path, LsmManifestHeader hdr, const std::vector<uint64_t> &run_ids);
+void remove_lsm_path(const std::string &path);
+// Stage steps of a run with n keys, returns the stage count
+int lsm_run_layout(size_t n, size_t *stage_size_steps);
+
+// Fixed set of threads running queued tasks in order; tasks must not throw
+class IndexWorkerPool {
+    std::mutex lock;
+    std::condition_variable cv;
+    std::condition_variable idle_cv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    size_t busy = 0;
+    bool running = false;
+
+    void worker_loop();
+
+    public:
+    IndexWorkerPool() {}
+    IndexWorkerPool(const IndexWorkerPool&) = delete;
+    IndexWorkerPool &operator=(const IndexWorkerPool&) = delete;
+
+    void start(unsigned nthreads);
+    void push(std::function<void()> task);
+    // Blocks until the queue is empty and no task runs
+    void wait_idle();
+    // Finishes running tasks, drops queued ones
+    void stop();
+
+    ~IndexWorkerPool() {
+        stop();
+    }
+};
+
+// Log structured sorted index: inserts go to an OrderStatTree memtable, a full memtable
+// is frozen and flushed by a background thread into an immutable static run (multi-stage
+// layout in a BlockStorage file). Runs of the same size tier are merged in the background
+// once `fanout` of them pile up, so a key is rewritten O(log_fanout(n)) times.
+// Reads take a snapshot of the runs and merge them with the memtables. Every run has a
+// bloom filter next to it, point lookups (start == end) skip runs it rules out.
+// Insert only - a multiset of keys like the runs it is made of.
+template<class T, class Fless = std::less<T>, class Fhash = BloomKeyHash<T>>
+class LsmSortIndex {
+    struct Run {
+        uint64_t id;
+        BlockStorage<T> storage;
+        std::unique_ptr<BloomFilter> filter;
+        size_t stage_size_steps[LSM_MAX_STAGES];
+        size_t stage_ends[LSM_MAX_STAGES];
+        int nstages;
+        bool compacting = false;
+
+        Run(const std::string &path, uint64_t id)
+            : id(id), storage(path.c_str(), true), filter(open_bloom_filter(path.c_str())) {
+            nstages = lsm_run_layout(storage.size(), stage_size_steps);
+            compute_stage_ends(storage.size(), stage_ends, stage_size_steps, nstages);
+        }
+
+        size_t size() const {
+            return storage.size();
+        }
+
+        std::span<const T> keys() const {
+            return std::span<const T>(storage.mapped(), storage.size());
+        }
+
+        bool may_contain(uint64_t key_hash) const {
+            return !filter || filter->may_contain(key_hash);
+        }
+    };
+    typedef OrderStatTree<T, Fless> Memtable;
+    typedef std::vector<std::shared_ptr<Run>> RunList;
+
+    // Position in one sorted source of a merge - a run, or a plain sorted array without stages
+    struct Cursor {
+        const T *data;
+        const size_t *stage_ends;
+        const size_t *stage_size_steps;
+        int nstages;
+        size_t pos, end;
+
+        const T &value() const {
+            if (!stage_ends) {
+                return data[pos];
+            }
+            return data[get_idx_position(pos, stage_ends, stage_size_steps, nstages)];
+        }
+    };
+
+    std::string dirname;
+    std::string manifest_path;
+    size_t memtable_limit;
+    size_t fanout;
+    Fless less;
+    Fhash hash;
+
+    // Guards everything below; readers share it for the memtables and the run list
+    std::shared_mutex lock;
+    std::condition_variable_any flushed_cv;
+    LsmManifestHeader manifest;
+    std::unique_ptr<Memtable> active;
+    std::unique_ptr<Memtable> frozen;
+    RunList runs;
+    std::exception_ptr background_error;
+    // A failed merge keeps its runs, they are merged again after the next flush;
+    // the error is reported once by wait_idle
+    std::exception_ptr compaction_error;
+
+    IndexWorkerPool workers;
+
+    void store_manifest() {
+        std::vector<uint64_t> run_ids;
+        for (auto &run : runs) {
+            run_ids.push_back(run->id);
+        }
+        manifest.nruns = run_ids.size();
+        write_lsm_manifest(manifest_path, manifest, run_ids);
+    }
+
+    void check_background_error() {
+        if (background_error) {
+            std::rethrow_exception(background_error);
+        }
+    }
+
+    // Background task wrapper - the first failure is reported by the next insert / flush
+    void run_task(const std::function<void()> &task) {
+        try {
+            task();
+        } catch (...) {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            if (!background_error) {
+                background_error = std::current_exception();
+            }
+            flushed_cv.notify_all();
+        }
+    }
+
+    std::shared_ptr<Run> write_run(uint64_t id, const T *sorted, size_t n) {
+        auto path = lsm_run_path(dirname, id);
+        {
+            size_t stage_size_steps[LSM_MAX_STAGES], stage_ends[LSM_MAX_STAGES];
+            auto nstages = lsm_run_layout(n, stage_size_steps);
+            compute_stage_ends(n, stage_ends, stage_size_steps, nstages);
+            BlockStorage<T> storage(path.c_str(), false, n);
+            scatter_sort_index(sorted, storage.mapped(), n, stage_ends, stage_size_steps, nstages, 1);
+            storage.sync();
+        }
+        build_bloom_filter<T, Fhash>(bloom_path(path.c_str()).c_str(), std::span<const T>(sorted, n));
+        return std::make_shared<Run>(path, id);
+    }
+
+    // Under the exclusive lock: freeze the active memtable and queue its flush
+    void rotate(std::unique_lock<std::shared_mutex> &guard) {
+        flushed_cv.wait(guard, [&]() { return !frozen || background_error; });
+        check_background_error();
+        frozen = std::move(active);
+        manifest.frozen_mem = manifest.active_mem;
+        manifest.active_mem = manifest.next_id++;
+        active = std::make_unique<Memtable>(lsm_mem_path(dirname, manifest.active_mem).c_str(), false);
+        store_manifest();
+        workers.push([this]() { run_task([this]() { flush_frozen(); }); });
+    }
+
+    void flush_frozen() {
+        // Nobody writes a frozen memtable, it is read without the lock
+        std::vector<T> sorted;
+        sorted.reserve(frozen->size());
+        frozen->for_each([&](const T &value) { sorted.push_back(value); });
+
+        std::shared_ptr<Run> run;
+        if (!sorted.empty()) {
+            uint64_t id;
+            {
+                std::unique_lock<std::shared_mutex> guard(lock);
+                id = manifest.next_id++;
+            }
+            run = write_run(id, sorted.data(), sorted.size());
+        }
+
+        std::unique_ptr<Memtable> flushed;
+        uint64_t flushed_id;
+        {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            if (run) {
+                runs.push_back(run);
+            }
+            flushed = std::move(frozen);
+            flushed_id = manifest.frozen_mem;
+            manifest.frozen_mem = 0;
+            store_manifest();
+        }
+        flushed_cv.notify_all();
+        flushed.reset();
+        remove_lsm_path(lsm_mem_path(dirname, flushed_id));
+        schedule_compactions();
+    }
+
+    // Size tier of a run: memtable sized runs are tier 0, each tier is fanout times larger
+    size_t run_tier(size_t n) const {
+        size_t tier = 0;
+        for (auto size = memtable_limit; size * fanout <= n; size *= fanout) {
+            tier++;
+        }
+        return tier;
+    }
+
+    void schedule_compactions() {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        std::vector<RunList> tiers;
+        for (auto &run : runs) {
+            if (run->compacting) {
+                continue;
+            }
+            auto tier = run_tier(run->size());
+            if (tiers.size() <= tier) {
+                tiers.resize(tier + 1);
+            }
+            tiers[tier].push_back(run);
+        }
+        // Groups of different tiers touch disjoint runs, so they merge in parallel
+        for (auto &tier : tiers) {
+            for (size_t it = 0; it + fanout <= tier.size(); it += fanout) {
+                auto group = std::make_shared<RunList>(tier.begin() + it, tier.begin() + it + fanout);
+                for (auto &run : *group) {
+                    run->compacting = true;
+                }
+                workers.push([this, group]() { run_task([this, group]() { compact(*group); }); });
+            }
+        }
+    }
+
+    // k-way merge of the cursors in key order
+    template<typename Fvisit>
+    void merge_cursors(std::vector<Cursor> &cursors, Fvisit visit) const {
+        auto greater = [&](size_t a, size_t b) { return less(cursors[b].value(), cursors[a].value()); };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+        for (size_t it = 0; it < cursors.size(); it++) {
+            if (cursors[it].pos < cursors[it].end) {
+                heap.push(it);
+            }
+        }
+        while (!heap.empty()) {
+            auto it = heap.top();
+            heap.pop();
+            visit(cursors[it].value());
+            if (++cursors[it].pos < cursors[it].end) {
+                heap.push(it);
+            }
+        }
+    }
+
+    void compact(const RunList &group) {
+        try {
+            merge_group(group);
+        } catch (...) {
+            // Give the runs back to the next schedule_compactions
+            std::unique_lock<std::shared_mutex> guard(lock);
+            for (auto &run : group) {
+                run->compacting = false;
+            }
+            if (!compaction_error) {
+                compaction_error = std::current_exception();
+            }
+            return;
+        }
+        schedule_compactions();
+    }
+
+    void merge_group(const RunList &group) {
+        std::vector<Cursor> cursors;
+        size_t n = 0;
+        for (auto &run : group) {
+            cursors.push_back({run->storage.mapped(), run->stage_ends, run->stage_size_steps, run->nstages, 0, run->size()});
+            n += run->size();
+        }
+        std::vector<T> sorted;
+        sorted.reserve(n);
+        merge_cursors(cursors, [&](const T &value) { sorted.push_back(value); });
+
+        uint64_t id;
+        {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            id = manifest.next_id++;
+        }
+        std::shared_ptr<Run> merged;
+        try {
+            merged = write_run(id, sorted.data(), sorted.size());
+        } catch (...) {
+            // Not in the manifest yet, drop what was written (e.g. after ENOSPC)
+            auto path = lsm_run_path(dirname, id);
+            std::error_code err;
+            std::filesystem::remove(path, err);
+            std::filesystem::remove(bloom_path(path.c_str()), err);
+            throw;
+        }
+        {
+            std::unique_lock<std::shared_mutex> guard(lock);
+            std::erase_if(runs, [&](const std::shared_ptr<Run> &run) {
+                return std::find(group.begin(), group.end(), run) != group.end();
+            });
+            runs.push_back(merged);
+            store_manifest();
+        }
+        // Snapshots still holding the old runs keep their mappings
+        for (auto &run : group) {
+            auto path = lsm_run_path(dirname, run->id);
+            remove_lsm_path(path);
+            remove_lsm_path(bloom_path(path.c_str()));
+        }
+    }
+
+    bool is_point(const T &start, const T &end) const {
+        return !less(start, end) && !less(end, start);
+    }
+
+    RunList snapshot_runs() {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        return runs;
+    }
+
+    public:
+    // memtable_limit keys per memtable, fanout runs of a tier are merged into one
+    LsmSortIndex(
+        const char *dirname, unsigned nthreads = 2,
+        size_t memtable_limit = 1 << 20, size_t fanout = 4
+    ) : dirname(dirname), manifest_path(init_lsm_dir(dirname, false)),
+        memtable_limit(std::max<size_t>(memtable_limit, 1)), fanout(std::max<size_t>(fanout, 2)) {
+        std::vector<uint64_t> run_ids;
+        if (!read_lsm_manifest(manifest_path, &manifest, &run_ids)) {
+            manifest = {};
+            manifest.active_mem = 1;
+            manifest.next_id = 2;
+        }
+        for (auto id : run_ids) {
+            runs.push_back(std::make_shared<Run>(lsm_run_path(this->dirname, id), id));
+        }
+        active = std::make_unique<Memtable>(lsm_mem_path(this->dirname, manifest.active_mem).c_str(), false);
+        if (manifest.frozen_mem) {
+            // A flush did not finish before close, redo it
+            frozen = std::make_unique<Memtable>(lsm_mem_path(this->dirname, manifest.frozen_mem).c_str(), false);
+        }
+        store_manifest();
+
+        workers.start(std::max(nthreads, 1u));
+        if (frozen) {
+            workers.push([this]() { run_task([this]() { flush_frozen(); }); });
+        }
+        schedule_compactions();
+    }
+
+    LsmSortIndex(const LsmSortIndex&) = delete;
+    LsmSortIndex &operator=(const LsmSortIndex&) = delete;
+
+    void insert(const T &value) {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        check_background_error();
+        active->insert(value);
+        if (active->size() >= memtable_limit) {
+            // Stalls while the previous memtable is still being flushed
+            rotate(guard);
+        }
+    }
+
+    // Moves everything inserted so far to runs and waits for the flush
+    void flush() {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        check_background_error();
+        if (active->size()) {
+            rotate(guard);
+        }
+        flushed_cv.wait(guard, [&]() { return !frozen || background_error; });
+        check_background_error();
+    }
+
+    // Waits for queued flushes and compactions
+    void wait_idle() {
+        workers.wait_idle();
+        std::unique_lock<std::shared_mutex> guard(lock);
+        check_background_error();
+        if (compaction_error) {
+            auto error = compaction_error;
+            compaction_error = NULL;
+            std::rethrow_exception(error);
+        }
+    }
+
+    size_t size() {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        size_t n = active->size() + (frozen ? frozen->size() : 0);
+        for (auto &run : runs) {
+            n += run->size();
+        }
+        return n;
+    }
+
+    size_t nruns() {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        return runs.size();
+    }
+
+    // Keys in [start, end], both ends inclusive like find_idx_range
+    size_t range_count(const T &start, const T &end) {
+        size_t count = 0;
+        RunList snapshot;
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            count += active->range_count(start, end);
+            if (frozen) {
+                count += frozen->range_count(start, end);
+            }
+            snapshot = runs;
+        }
+        auto point = is_point(start, end);
+        uint64_t key_hash = point ? hash(start) : 0;
+        for (auto &run : snapshot) {
+            if (point && !run->may_contain(key_hash)) {
+                continue;
+            }
+            auto [first, last] = find_key_range<T>(
+                run->keys(), run->stage_ends, run->stage_size_steps, run->nstages, start, end, less
+            );
+            count += last - first;
+        }
+        return count;
+    }
+
+    // Copies of key
+    size_t count(const T &key) {
+        return range_count(key, key);
+    }
+
+    // Keys in [start, end] in order, merged over the memtables and all runs
+    template<typename Fvisit>
+    void range_for_each(const T &start, const T &end, Fvisit visit) {
+        std::vector<T> mem_keys[2];
+        RunList snapshot;
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            active->for_each_range(start, end, [&](const T &value) { mem_keys[0].push_back(value); });
+            if (frozen) {
+                frozen->for_each_range(start, end, [&](const T &value) { mem_keys[1].push_back(value); });
+            }
+            snapshot = runs;
+        }
+
+        std::vector<Cursor> cursors;
+        for (auto &keys : mem_keys) {
+            cursors.push_back({keys.data(), NULL, NULL, 1, 0, keys.size()});
+        }
+        auto point = is_point(start, end);
+        uint64_t key_hash = point ? hash(start) : 0;
+        for (auto &run : snapshot) {
+            if (point && !run->may_contain(key_hash)) {
+                continue;
+            }
+            auto [first, last] = find_key_range<T>(
+                run->keys(), run->stage_ends, run->stage_size_steps, run->nstages, start, end, less
+            );
+            cursors.push_back({run->storage.mapped(), run->stage_ends, run->stage_size_steps, run->nstages, first, last});
+        }
+        merge_cursors(cursors, visit);
+    }
+
+    ~LsmSortIndex() {
+        // Queued work is dropped, an unfinished flush is redone on the next open
+        workers.stop();
+    }
+};
@@ -1,5 +1,9 @@
 #include "idx_sort_static.h"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 
 void compute_stage_ends(
     size_t n, size_t *stage_ends,
@@ -43,7 +47,8 @@ size_t get_stage_pos_items_count(
     if (stage == 0) {
         return stage_nitems;
     } else {
-        return stage_nitems + stage_nitems / (stage_size_steps[stage-1] + 1);
+        // Lifted items sit after every full group of `step` stage items
+        return stage_nitems + stage_pos / stage_size_steps[stage-1];
     }
 }
 
@@ -53,3 +58,249 @@ size_t get_next_stage_pos(
     size_t nitems = get_stage_pos_items_count(stage_pos, stage, stage_size_steps);
     return nitems * stage_size_steps[stage];
 }
+
+int idx_stage_layout(size_t n, size_t step, size_t top_items, size_t *stage_size_steps, int max_stages) {
+    int nstages = 1;
+    for (auto top = n; top > top_items && nstages < max_stages; top /= step + 1) {
+        stage_size_steps[nstages - 1] = step;
+        nstages++;
+    }
+    stage_size_steps[nstages - 1] = 0;
+    return nstages;
+}
+
+template<class T>
+static size_t count_less_sw(const T *data, size_t n, T key) {
+    size_t count = 0;
+    for (size_t it = 0; it < n; it++) {
+        count += data[it] < key;
+    }
+    return count;
+}
+
+template<class T>
+static size_t count_greater_sw(const T *data, size_t n, T key) {
+    size_t count = 0;
+    for (size_t it = 0; it < n; it++) {
+        count += key < data[it];
+    }
+    return count;
+}
+
+#if defined(__x86_64__)
+
+// Per type compare ops, lt/gt return one bit per lane
+
+#define IDX_AVX2 __attribute__((target("avx2,popcnt")))
+#define IDX_AVX512 __attribute__((target("avx512f,popcnt")))
+
+template<class T>
+struct Avx2Ops;
+
+template<>
+struct Avx2Ops<int32_t> {
+    typedef __m256i V;
+    constexpr static size_t LANES = 8;
+    IDX_AVX2 static V set1(int32_t key) { return _mm256_set1_epi32(key); }
+    IDX_AVX2 static V load(const int32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const V*>(p)); }
+    IDX_AVX2 static V load_tail(const int32_t *p, size_t n) {
+        auto mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        return _mm256_maskload_epi32(p, mask);
+    }
+    IDX_AVX2 static unsigned lt(V x, V key) { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, x))); }
+    IDX_AVX2 static unsigned gt(V x, V key) { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, key))); }
+};
+
+template<>
+struct Avx2Ops<int64_t> {
+    typedef __m256i V;
+    constexpr static size_t LANES = 4;
+    IDX_AVX2 static V set1(int64_t key) { return _mm256_set1_epi64x(key); }
+    IDX_AVX2 static V load(const int64_t *p) { return _mm256_loadu_si256(reinterpret_cast<const V*>(p)); }
+    IDX_AVX2 static V load_tail(const int64_t *p, size_t n) {
+        auto mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_setr_epi64x(0, 1, 2, 3));
+        return _mm256_maskload_epi64(reinterpret_cast<const long long*>(p), mask);
+    }
+    IDX_AVX2 static unsigned lt(V x, V key) { return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key, x))); }
+    IDX_AVX2 static unsigned gt(V x, V key) { return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, key))); }
+};
+
+// No unsigned compare before AVX-512 - flipping the sign bit maps the order onto signed
+template<>
+struct Avx2Ops<uint64_t> {
+    typedef __m256i V;
+    constexpr static size_t LANES = 4;
+    IDX_AVX2 static V flip(V x) { return _mm256_xor_si256(x, _mm256_set1_epi64x(INT64_MIN)); }
+    IDX_AVX2 static V set1(uint64_t key) { return flip(_mm256_set1_epi64x(key)); }
+    IDX_AVX2 static V load(const uint64_t *p) { return flip(_mm256_loadu_si256(reinterpret_cast<const V*>(p))); }
+    IDX_AVX2 static V load_tail(const uint64_t *p, size_t n) {
+        auto mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_setr_epi64x(0, 1, 2, 3));
+        return flip(_mm256_maskload_epi64(reinterpret_cast<const long long*>(p), mask));
+    }
+    IDX_AVX2 static unsigned lt(V x, V key) { return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key, x))); }
+    IDX_AVX2 static unsigned gt(V x, V key) { return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, key))); }
+};
+
+template<>
+struct Avx2Ops<float> {
+    typedef __m256 V;
+    constexpr static size_t LANES = 8;
+    IDX_AVX2 static V set1(float key) { return _mm256_set1_ps(key); }
+    IDX_AVX2 static V load(const float *p) { return _mm256_loadu_ps(p); }
+    IDX_AVX2 static V load_tail(const float *p, size_t n) {
+        auto mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        return _mm256_maskload_ps(p, mask);
+    }
+    IDX_AVX2 static unsigned lt(V x, V key) { return _mm256_movemask_ps(_mm256_cmp_ps(x, key, _CMP_LT_OQ)); }
+    IDX_AVX2 static unsigned gt(V x, V key) { return _mm256_movemask_ps(_mm256_cmp_ps(x, key, _CMP_GT_OQ)); }
+};
+
+template<>
+struct Avx2Ops<double> {
+    typedef __m256d V;
+    constexpr static size_t LANES = 4;
+    IDX_AVX2 static V set1(double key) { return _mm256_set1_pd(key); }
+    IDX_AVX2 static V load(const double *p) { return _mm256_loadu_pd(p); }
+    IDX_AVX2 static V load_tail(const double *p, size_t n) {
+        auto mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_setr_epi64x(0, 1, 2, 3));
+        return _mm256_maskload_pd(p, mask);
+    }
+    IDX_AVX2 static unsigned lt(V x, V key) { return _mm256_movemask_pd(_mm256_cmp_pd(x, key, _CMP_LT_OQ)); }
+    IDX_AVX2 static unsigned gt(V x, V key) { return _mm256_movemask_pd(_mm256_cmp_pd(x, key, _CMP_GT_OQ)); }
+};
+
+template<class T, bool greater>
+IDX_AVX2 static size_t count_avx2(const T *data, size_t n, T key) {
+    typedef Avx2Ops<T> Ops;
+    auto k = Ops::set1(key);
+    size_t count = 0;
+    size_t it = 0;
+    for (; it + Ops::LANES <= n; it += Ops::LANES) {
+        auto x = Ops::load(data + it);
+        count += __builtin_popcount(greater ? Ops::gt(x, k) : Ops::lt(x, k));
+    }
+    if (it < n) {
+        // Masked out lanes load as zero and may compare either way, drop their bits
+        auto x = Ops::load_tail(data + it, n - it);
+        auto bits = greater ? Ops::gt(x, k) : Ops::lt(x, k);
+        count += __builtin_popcount(bits & ((1u << (n - it)) - 1));
+    }
+    return count;
+}
+
+template<class T>
+struct Avx512Ops;
+
+template<>
+struct Avx512Ops<int32_t> {
+    typedef __m512i V;
+    constexpr static size_t LANES = 16;
+    IDX_AVX512 static V set1(int32_t key) { return _mm512_set1_epi32(key); }
+    IDX_AVX512 static V load(const int32_t *p, __mmask16 mask) { return _mm512_maskz_loadu_epi32(mask, p); }
+    IDX_AVX512 static unsigned lt(__mmask16 mask, V x, V key) { return _mm512_mask_cmplt_epi32_mask(mask, x, key); }
+    IDX_AVX512 static unsigned gt(__mmask16 mask, V x, V key) { return _mm512_mask_cmpgt_epi32_mask(mask, x, key); }
+};
+
+template<>
+struct Avx512Ops<int64_t> {
+    typedef __m512i V;
+    constexpr static size_t LANES = 8;
+    IDX_AVX512 static V set1(int64_t key) { return _mm512_set1_epi64(key); }
+    IDX_AVX512 static V load(const int64_t *p, __mmask8 mask) { return _mm512_maskz_loadu_epi64(mask, p); }
+    IDX_AVX512 static unsigned lt(__mmask8 mask, V x, V key) { return _mm512_mask_cmplt_epi64_mask(mask, x, key); }
+    IDX_AVX512 static unsigned gt(__mmask8 mask, V x, V key) { return _mm512_mask_cmpgt_epi64_mask(mask, x, key); }
+};
+
+template<>
+struct Avx512Ops<uint64_t> {
+    typedef __m512i V;
+    constexpr static size_t LANES = 8;
+    IDX_AVX512 static V set1(uint64_t key) { return _mm512_set1_epi64(key); }
+    IDX_AVX512 static V load(const uint64_t *p, __mmask8 mask) { return _mm512_maskz_loadu_epi64(mask, p); }
+    IDX_AVX512 static unsigned lt(__mmask8 mask, V x, V key) { return _mm512_mask_cmplt_epu64_mask(mask, x, key); }
+    IDX_AVX512 static unsigned gt(__mmask8 mask, V x, V key) { return _mm512_mask_cmpgt_epu64_mask(mask, x, key); }
+};
+
+template<>
+struct Avx512Ops<float> {
+    typedef __m512 V;
+    constexpr static size_t LANES = 16;
+    IDX_AVX512 static V set1(float key) { return _mm512_set1_ps(key); }
+    IDX_AVX512 static V load(const float *p, __mmask16 mask) { return _mm512_maskz_loadu_ps(mask, p); }
+    IDX_AVX512 static unsigned lt(__mmask16 mask, V x, V key) { return _mm512_mask_cmp_ps_mask(mask, x, key, _CMP_LT_OQ); }
+    IDX_AVX512 static unsigned gt(__mmask16 mask, V x, V key) { return _mm512_mask_cmp_ps_mask(mask, x, key, _CMP_GT_OQ); }
+};
+
+template<>
+struct Avx512Ops<double> {
+    typedef __m512d V;
+    constexpr static size_t LANES = 8;
+    IDX_AVX512 static V set1(double key) { return _mm512_set1_pd(key); }
+    IDX_AVX512 static V load(const double *p, __mmask8 mask) { return _mm512_maskz_loadu_pd(mask, p); }
+    IDX_AVX512 static unsigned lt(__mmask8 mask, V x, V key) { return _mm512_mask_cmp_pd_mask(mask, x, key, _CMP_LT_OQ); }
+    IDX_AVX512 static unsigned gt(__mmask8 mask, V x, V key) { return _mm512_mask_cmp_pd_mask(mask, x, key, _CMP_GT_OQ); }
+};
+
+template<class T, bool greater>
+IDX_AVX512 static size_t count_avx512(const T *data, size_t n, T key) {
+    typedef Avx512Ops<T> Ops;
+    auto k = Ops::set1(key);
+    size_t count = 0;
+    for (size_t it = 0; it < n; it += Ops::LANES) {
+        // Masked loads never touch memory past the block, the tail needs no separate path
+        auto left = n - it;
+        unsigned mask = left >= Ops::LANES ? (1u << Ops::LANES) - 1 : (1u << left) - 1;
+        auto x = Ops::load(data + it, mask);
+        count += __builtin_popcount(greater ? Ops::gt(mask, x, k) : Ops::lt(mask, x, k));
+    }
+    return count;
+}
+
+enum class IdxSimdLevel {
+    NONE,
+    AVX2,
+    AVX512
+};
+
+static IdxSimdLevel idx_simd_level() {
+    static const IdxSimdLevel level = __builtin_cpu_supports("avx512f")
+        ? IdxSimdLevel::AVX512
+        : __builtin_cpu_supports("avx2") ? IdxSimdLevel::AVX2 : IdxSimdLevel::NONE;
+    return level;
+}
+
+template<class T, bool greater>
+static size_t count_dispatch(const T *data, size_t n, T key) {
+    switch (idx_simd_level()) {
+        case IdxSimdLevel::AVX512:
+            return count_avx512<T, greater>(data, n, key);
+        case IdxSimdLevel::AVX2:
+            return count_avx2<T, greater>(data, n, key);
+        default:
+            return greater ? count_greater_sw(data, n, key) : count_less_sw(data, n, key);
+    }
+}
+
+#else
+
+template<class T, bool greater>
+static size_t count_dispatch(const T *data, size_t n, T key) {
+    return greater ? count_greater_sw(data, n, key) : count_less_sw(data, n, key);
+}
+
+#endif
+
+// x <= key is !(key < x), so every type gets it from the greater-than count
+#define IDX_COUNT_FUNCTIONS(T) \
+    size_t idx_count_less(const T *data, size_t n, T key) { \
+        return count_dispatch<T, false>(data, n, key); \
+    } \
+    size_t idx_count_less_equal(const T *data, size_t n, T key) { \
+        return n - count_dispatch<T, true>(data, n, key); \
+    }
+
+IDX_COUNT_FUNCTIONS(int32_t)
+IDX_COUNT_FUNCTIONS(int64_t)
+IDX_COUNT_FUNCTIONS(uint64_t)
+IDX_COUNT_FUNCTIONS(float)
+IDX_COUNT_FUNCTIONS(double)
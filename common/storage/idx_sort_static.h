@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
 #include <tuple>
+#include <type_traits>
 
 
 // tree_size = last_layer_items + all_items // (last_stage_step + 1)
@@ -20,49 +25,279 @@ size_t get_stage_pos_items_count(
 size_t get_next_stage_pos(
     size_t stage_pos, int stage, const size_t *stage_size_steps
 );
+// Steps for n items: stages of `step` are added until the top stage holds at most
+// top_items (small enough to stay cached), returns the stage count
+int idx_stage_layout(size_t n, size_t step, size_t top_items, size_t *stage_size_steps, int max_stages);
+
+// Branchless counts over a sorted block: items < key, items <= key.
+// AVX-512 or AVX2 compare + popcount when the CPU has them, masked loads for the tail.
+size_t idx_count_less(const int32_t *data, size_t n, int32_t key);
+size_t idx_count_less(const int64_t *data, size_t n, int64_t key);
+size_t idx_count_less(const uint64_t *data, size_t n, uint64_t key);
+size_t idx_count_less(const float *data, size_t n, float key);
+size_t idx_count_less(const double *data, size_t n, double key);
+size_t idx_count_less_equal(const int32_t *data, size_t n, int32_t key);
+size_t idx_count_less_equal(const int64_t *data, size_t n, int64_t key);
+size_t idx_count_less_equal(const uint64_t *data, size_t n, uint64_t key);
+size_t idx_count_less_equal(const float *data, size_t n, float key);
+size_t idx_count_less_equal(const double *data, size_t n, double key);
+
+// Key types with a SIMD in-stage search; uint64_t also covers fixed (normalized) key prefixes
+template<class T>
+constexpr bool idx_simd_key = std::is_same_v<T, int32_t> || std::is_same_v<T, int64_t>
+    || std::is_same_v<T, uint64_t> || std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+// Tree indexes [begin, end) where pred holds for a prefix - first index where it does not
+template<typename Fpred>
+size_t idx_partition_point(size_t begin, size_t end, Fpred &&pred) {
+    if (begin >= end) {
+        return begin;
+    }
+    auto base = begin;
+    auto len = end - begin;
+    while (len > 1) {
+        auto half = len / 2;
+        base = pred(base + half - 1) ? base + half : base;
+        len -= half;
+    }
+    return base + pred(base);
+}
+
+// Sorted array items for which pred holds (pred(tree_idx) must hold for a prefix of the array).
+// Every step+1-th item of a stage is lifted to the stage above, so knowing c items of the
+// upper stage satisfy pred pins the answer in this stage to c * (step + 1) plus a count over
+// the `step` items at stage position c * step.
+// count_window(begin, end) returns how many tree indexes in [begin, end) satisfy pred.
+template<typename Fpred, typename Fcount_window>
+size_t find_idx_count(
+    const size_t *stage_ends, const size_t *stage_size_steps, int nstages,
+    Fpred &&pred, Fcount_window &&count_window
+) {
+    auto count = idx_partition_point(0, stage_ends[0], pred);
+    for (int stage = 1; stage < nstages; stage++) {
+        auto step = stage_size_steps[stage-1];
+        auto window = stage_ends[stage-1] + count * step;
+        auto window_end = std::min(window + step, stage_ends[stage]);
+        count = count * (step + 1) + (window < window_end ? count_window(window, window_end) : 0);
+    }
+    return count;
+}
+
+// Keys advanced together by the batch lookups - enough misses in flight to cover
+// memory latency while every probed line still fits in L1
+constexpr static size_t IDX_BATCH_SIZE = 32;
+
+// Prefetch the cache lines of tree items [begin, end)
+template<class T>
+void idx_prefetch_items(const T *data, size_t begin, size_t end) {
+    auto addr = reinterpret_cast<uintptr_t>(data + begin) & ~uintptr_t(63);
+    auto last = reinterpret_cast<uintptr_t>(data + end);
+    for (; addr < last; addr += 64) {
+        __builtin_prefetch(reinterpret_cast<const void*>(addr));
+    }
+}
+
+// find_idx_count for keys [0, nkeys), results in counts.
+// Keys move in lockstep - every stage first prefetches the next probe of each key in the
+// batch, then compares, so the misses of the whole batch overlap.
+// pred(key_idx, tree_idx), count_window(key_idx, begin, end), prefetch(begin, end).
+template<typename Fpred, typename Fcount_window, typename Fprefetch>
+void find_idx_count_batch(
+    const size_t *stage_ends, const size_t *stage_size_steps, int nstages,
+    size_t nkeys, size_t *counts,
+    Fpred &&pred, Fcount_window &&count_window, Fprefetch &&prefetch
+) {
+    for (size_t batch = 0; batch < nkeys; batch += IDX_BATCH_SIZE) {
+        auto batch_end = std::min(batch + IDX_BATCH_SIZE, nkeys);
+
+        // Binary search of the first stage, all keys go through the same halving sequence
+        auto len = stage_ends[0];
+        for (auto key_idx = batch; key_idx < batch_end; key_idx++) {
+            counts[key_idx] = 0;
+        }
+        while (len > 1) {
+            auto half = len / 2;
+            for (auto key_idx = batch; key_idx < batch_end; key_idx++) {
+                auto base = counts[key_idx];
+                counts[key_idx] = pred(key_idx, base + half - 1) ? base + half : base;
+            }
+            len -= half;
+            auto probe = len > 1 ? len / 2 - 1 : 0;
+            for (auto key_idx = batch; key_idx < batch_end; key_idx++) {
+                prefetch(counts[key_idx] + probe, counts[key_idx] + probe + 1);
+            }
+        }
+        if (len) {
+            for (auto key_idx = batch; key_idx < batch_end; key_idx++) {
+                counts[key_idx] += pred(key_idx, counts[key_idx]);
+            }
+        }
+
+        for (int stage = 1; stage < nstages; stage++) {
+            auto step = stage_size_steps[stage-1];
+            auto stage_begin = stage_ends[stage-1];
+            auto stage_end = stage_ends[stage];
+            for (auto key_idx = batch; key_idx < batch_end; key_idx++) {
+                auto window = stage_begin + counts[key_idx] * step;
+                auto window_end = std::min(window + step, stage_end);
+                if (window < window_end) {
+                    prefetch(window, window_end);
+                }
+            }
+            for (auto key_idx = batch; key_idx < batch_end; key_idx++) {
+                auto count = counts[key_idx];
+                auto window = stage_begin + count * step;
+                auto window_end = std::min(window + step, stage_end);
+                counts[key_idx] = count * (step + 1)
+                    + (window < window_end ? count_window(key_idx, window, window_end) : 0);
+            }
+        }
+    }
+}
 
 // less_start(tree_idx) -> tree_idx<search_interval_start
 // less_end(tree_idx) -> search_interval_end<tree_idx
+// Returns [start, end) positions in the sorted array of the items inside the interval
 template<typename Fless_start, typename Fless_end>
-auto find_idx_range(
+std::tuple<size_t, size_t> find_idx_range(
     const size_t *stage_ends, const size_t *stage_size_steps, int nstages,
     Fless_start &&less_start, Fless_end &&less_end
 ) {
-    auto layer_idx_end = 0;
-    while (layer_idx_end < stage_ends[0] && !less_end(layer_idx_end)) {
-        layer_idx_end ++;
-    }
-    auto layer_idx_start = layer_idx_end;
-    while (layer_idx_start > 0 && !less_start(layer_idx_start-1)) {
-        layer_idx_start --;
-    }
-
-    auto result_start = layer_idx_start;
-    auto result_end = layer_idx_end;
+    auto before_end = [&](size_t tree_idx) { return !less_end(tree_idx); };
+    // No early exit - a fixed trip count over a stage window beats mispredicted branches
+    auto count_start = [&](size_t begin, size_t end) {
+        size_t count = 0;
+        for (auto tree_idx = begin; tree_idx < end; tree_idx++) {
+            count += less_start(tree_idx);
+        }
+        return count;
+    };
+    auto count_end = [&](size_t begin, size_t end) {
+        size_t count = 0;
+        for (auto tree_idx = begin; tree_idx < end; tree_idx++) {
+            count += before_end(tree_idx);
+        }
+        return count;
+    };
+    return std::make_tuple(
+        find_idx_count(stage_ends, stage_size_steps, nstages, less_start, count_start),
+        find_idx_count(stage_ends, stage_size_steps, nstages, before_end, count_end)
+    );
+}
 
-    for (int stage = 1; stage < nstages; stage++) {
-        layer_idx_start = get_next_stage_pos(layer_idx_start, stage-1, stage_size_steps);
-        layer_idx_end = get_next_stage_pos(layer_idx_end, stage-1, stage_size_steps);
-
-        auto stage_start = stage_ends[stage-1];
-        auto stage_end = stage_ends[stage];
-        if (layer_idx_start > 0 && !less_start(stage_start+layer_idx_start-1)) {
-            do {
-                layer_idx_start --;
-            } while (layer_idx_start > 0 && !less_start(stage_start+layer_idx_start-1));
-            result_start = get_stage_pos_items_count(layer_idx_start, stage, stage_size_steps) - 1;
-        } else {
-            result_start = (result_start+1) * (stage_size_steps[stage-1] + 1);
+// find_idx_range for nkeys intervals at once, see find_idx_count_batch.
+// less_start(key_idx, tree_idx), less_end(key_idx, tree_idx), prefetch(begin, end);
+// interval key_idx lands in [starts[key_idx], ends[key_idx]).
+template<typename Fless_start, typename Fless_end, typename Fprefetch>
+void find_idx_range_batch(
+    const size_t *stage_ends, const size_t *stage_size_steps, int nstages,
+    size_t nkeys, size_t *starts, size_t *ends,
+    Fless_start &&less_start, Fless_end &&less_end, Fprefetch &&prefetch
+) {
+    auto before_end = [&](size_t key_idx, size_t tree_idx) { return !less_end(key_idx, tree_idx); };
+    auto count_start = [&](size_t key_idx, size_t begin, size_t end) {
+        size_t count = 0;
+        for (auto tree_idx = begin; tree_idx < end; tree_idx++) {
+            count += less_start(key_idx, tree_idx);
         }
-        if (layer_idx_end < stage_end && !less_end(stage_start+layer_idx_end)) {
-            do {
-                layer_idx_end ++;
-            } while (layer_idx_end < stage_end && !less_end(stage_start+layer_idx_end));
-            result_end = get_stage_pos_items_count(layer_idx_end, stage, stage_size_steps) - 1;
-        } else {
-            result_end = (result_end+1) * (stage_size_steps[stage-1] + 1);
+        return count;
+    };
+    auto count_end = [&](size_t key_idx, size_t begin, size_t end) {
+        size_t count = 0;
+        for (auto tree_idx = begin; tree_idx < end; tree_idx++) {
+            count += before_end(key_idx, tree_idx);
         }
+        return count;
+    };
+    // Both searches of a batch run back to back, the second one mostly hits lines the first loaded
+    for (size_t batch = 0; batch < nkeys; batch += IDX_BATCH_SIZE) {
+        auto n = std::min(IDX_BATCH_SIZE, nkeys - batch);
+        auto shift = [&](auto &&f) {
+            return [&, batch](size_t key_idx, auto... args) { return f(batch + key_idx, args...); };
+        };
+        find_idx_count_batch(
+            stage_ends, stage_size_steps, nstages, n, starts + batch,
+            shift(less_start), shift(count_start), prefetch
+        );
+        find_idx_count_batch(
+            stage_ends, stage_size_steps, nstages, n, ends + batch,
+            shift(before_end), shift(count_end), prefetch
+        );
     }
+}
 
-    return std::make_tuple(result_start, result_end);
+// find_idx_range over keys stored in index layout, e.g. `BlockView::span()` of the index file -
+// compares in place on mapped memory instead of copying stages out.
+// Integer and float keys with the default order use the SIMD stage search.
+template<class T, class Fless = std::less<T>>
+std::tuple<size_t, size_t> find_key_range(
+    std::span<const T> keys,
+    const size_t *stage_ends, const size_t *stage_size_steps, int nstages,
+    const T &start_key, const T &end_key, Fless &&less = Fless()
+) {
+    if constexpr (idx_simd_key<T> && std::is_same_v<std::decay_t<Fless>, std::less<T>>) {
+        auto data = keys.data();
+        return std::make_tuple(
+            find_idx_count(
+                stage_ends, stage_size_steps, nstages,
+                [&](size_t tree_idx) { return data[tree_idx] < start_key; },
+                [&](size_t begin, size_t end) { return idx_count_less(data + begin, end - begin, start_key); }
+            ),
+            find_idx_count(
+                stage_ends, stage_size_steps, nstages,
+                [&](size_t tree_idx) { return !(end_key < data[tree_idx]); },
+                [&](size_t begin, size_t end) { return idx_count_less_equal(data + begin, end - begin, end_key); }
+            )
+        );
+    } else {
+        return find_idx_range(
+            stage_ends, stage_size_steps, nstages,
+            [&](size_t tree_idx) { return less(keys[tree_idx], start_key); },
+            [&](size_t tree_idx) { return less(end_key, keys[tree_idx]); }
+        );
+    }
+}
+
+// find_key_range for every (start_keys[i], end_keys[i]) interval, results in starts[i], ends[i].
+// For probing many keys (joins, IN lists) - lookups overlap their cache misses.
+template<class T, class Fless = std::less<T>>
+void find_key_range_batch(
+    std::span<const T> keys,
+    const size_t *stage_ends, const size_t *stage_size_steps, int nstages,
+    std::span<const T> start_keys, std::span<const T> end_keys,
+    size_t *starts, size_t *ends, Fless &&less = Fless()
+) {
+    auto data = keys.data();
+    auto nkeys = std::min(start_keys.size(), end_keys.size());
+    auto prefetch = [&](size_t begin, size_t end) { idx_prefetch_items(data, begin, end); };
+    if constexpr (idx_simd_key<T> && std::is_same_v<std::decay_t<Fless>, std::less<T>>) {
+        for (size_t batch = 0; batch < nkeys; batch += IDX_BATCH_SIZE) {
+            auto n = std::min(IDX_BATCH_SIZE, nkeys - batch);
+            auto start_batch = start_keys.data() + batch;
+            auto end_batch = end_keys.data() + batch;
+            find_idx_count_batch(
+                stage_ends, stage_size_steps, nstages, n, starts + batch,
+                [&](size_t key_idx, size_t tree_idx) { return data[tree_idx] < start_batch[key_idx]; },
+                [&](size_t key_idx, size_t begin, size_t end) {
+                    return idx_count_less(data + begin, end - begin, start_batch[key_idx]);
+                },
+                prefetch
+            );
+            find_idx_count_batch(
+                stage_ends, stage_size_steps, nstages, n, ends + batch,
+                [&](size_t key_idx, size_t tree_idx) { return !(end_batch[key_idx] < data[tree_idx]); },
+                [&](size_t key_idx, size_t begin, size_t end) {
+                    return idx_count_less_equal(data + begin, end - begin, end_batch[key_idx]);
+                },
+                prefetch
+            );
+        }
+    } else {
+        find_idx_range_batch(
+            stage_ends, stage_size_steps, nstages, nkeys, starts, ends,
+            [&](size_t key_idx, size_t tree_idx) { return less(data[tree_idx], start_keys[key_idx]); },
+            [&](size_t key_idx, size_t tree_idx) { return less(end_keys[key_idx], data[tree_idx]); },
+            prefetch
+        );
+    }
 }
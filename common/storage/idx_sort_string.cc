@@ -0,0 +1,234 @@
+#include "idx_sort_string.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+
+constexpr static uint64_t STRING_IDX_MAGIC = 0x3252545358444953ULL;  // "SIDXSTR2"
+
+uint64_t string_key_prefix(std::string_view key) {
+    uint64_t prefix = 0;
+    memcpy(&prefix, key.data(), std::min<size_t>(key.size(), sizeof(prefix)));
+    return __builtin_bswap64(prefix);
+}
+
+size_t string_common_prefix_size(std::span<const std::string_view> sorted_keys) {
+    if (sorted_keys.empty()) {
+        return 0;
+    }
+    // Sorted - the first and the last key differ first
+    auto first = sorted_keys.front();
+    auto last = sorted_keys.back();
+    auto limit = std::min(first.size(), last.size());
+    size_t size = 0;
+    while (size < limit && first[size] == last[size]) {
+        size++;
+    }
+    return size;
+}
+
+static size_t pad8(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+static void put_varint(std::vector<byte> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(byte(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(byte(value));
+}
+
+static uint64_t get_varint(const byte *&pos) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        auto b = *pos++;
+        value |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+}
+
+bool StringBlockCursor::next() {
+    if (!left) {
+        return false;
+    }
+    // The first key has no shared part, its prefix length is stored as 0
+    auto shared = get_varint(pos);
+    auto suffix = get_varint(pos);
+    key.resize(shared);
+    key.append(reinterpret_cast<const char*>(pos), suffix);
+    pos += suffix;
+    left--;
+    return true;
+}
+
+size_t build_string_index(
+    const char *fname, std::vector<std::string_view> keys, unsigned block_keys, unsigned filter_bits_per_key
+) {
+    if (!block_keys) {
+        throw std::invalid_argument("String index blocks need at least one key.");
+    }
+    std::sort(keys.begin(), keys.end());
+    size_t nblocks = (keys.size() + block_keys - 1) / block_keys;
+    auto common_size = string_common_prefix_size(keys);
+
+    std::vector<uint64_t> sorted_prefixes(nblocks);
+    std::vector<uint64_t> offsets(nblocks + 1);
+    std::vector<byte> blocks;
+    for (size_t it = 0; it < keys.size(); it++) {
+        auto key = keys[it];
+        size_t shared = 0;
+        if (it % block_keys == 0) {
+            sorted_prefixes[it / block_keys] = string_key_prefix(key.substr(common_size));
+            offsets[it / block_keys] = blocks.size();
+        } else {
+            auto prev = keys[it - 1];
+            auto limit = std::min(prev.size(), key.size());
+            while (shared < limit && prev[shared] == key[shared]) {
+                shared++;
+            }
+        }
+        put_varint(blocks, shared);
+        put_varint(blocks, key.size() - shared);
+        blocks.insert(blocks.end(), key.begin() + shared, key.end());
+    }
+    offsets[nblocks] = blocks.size();
+
+    StringIndexHeader hdr = {};
+    size_t stage_size_steps[STRING_IDX_MAX_STAGES];
+    size_t stage_ends[STRING_IDX_MAX_STAGES];
+    hdr.nkeys = keys.size();
+    hdr.nblocks = nblocks;
+    hdr.block_keys = block_keys;
+    hdr.nstages = idx_stage_layout(nblocks, STRING_IDX_STEP, STRING_IDX_TOP_ITEMS, stage_size_steps, STRING_IDX_MAX_STAGES);
+    std::copy(stage_size_steps, stage_size_steps + hdr.nstages, hdr.stage_size_steps);
+    hdr.common_prefix_size = common_size;
+    hdr.data_size = blocks.size();
+    compute_stage_ends(nblocks, stage_ends, stage_size_steps, hdr.nstages);
+
+    auto common_padded = pad8(common_size);
+    auto prefixes_size = nblocks * sizeof(uint64_t);
+    auto offsets_size = (nblocks + 1) * sizeof(uint64_t);
+    remove_bloom_filter(fname);
+    BlockStorage<byte> storage(fname, false, sizeof(hdr) + common_padded + prefixes_size + offsets_size + blocks.size());
+    auto out = storage.mapped();
+    if (common_size) {
+        memcpy(out + sizeof(hdr), keys.front().data(), common_size);
+    }
+    auto body = out + sizeof(hdr) + common_padded;
+    auto prefixes = reinterpret_cast<uint64_t*>(body);
+    for (size_t it = 0; it < nblocks; it++) {
+        prefixes[get_idx_position(it, stage_ends, stage_size_steps, hdr.nstages)] = sorted_prefixes[it];
+    }
+    memcpy(body + prefixes_size, offsets.data(), offsets_size);
+    if (!blocks.empty()) {
+        memcpy(body + prefixes_size + offsets_size, blocks.data(), blocks.size());
+    }
+    hdr.magic = STRING_IDX_MAGIC;
+    memcpy(out, &hdr, sizeof(hdr));
+    storage.sync();
+    if (filter_bits_per_key) {
+        build_bloom_filter<std::string_view>(
+            bloom_path(fname).c_str(), std::span<const std::string_view>(keys), filter_bits_per_key
+        );
+    }
+    return keys.size();
+}
+
+StringSortIndex::StringSortIndex(const char *fname) : storage(fname, true) {
+    auto base = storage.mapped();
+    hdr = reinterpret_cast<const StringIndexHeader*>(base);
+    if (storage.size() < sizeof(*hdr) || hdr->magic != STRING_IDX_MAGIC) {
+        throw std::runtime_error("Not a string index file `" + std::string(fname) + "`.");
+    }
+    auto common_padded = pad8(hdr->common_prefix_size);
+    auto prefixes_size = hdr->nblocks * sizeof(uint64_t);
+    auto offsets_size = (hdr->nblocks + 1) * sizeof(uint64_t);
+    if (hdr->nstages < 1 || hdr->nstages > STRING_IDX_MAX_STAGES || !hdr->block_keys
+            || storage.size() < sizeof(*hdr) + common_padded + prefixes_size + offsets_size + hdr->data_size) {
+        throw std::runtime_error("String index file `" + std::string(fname) + "` is truncated or corrupted.");
+    }
+    common_prefix = std::string_view(reinterpret_cast<const char*>(base + sizeof(*hdr)), hdr->common_prefix_size);
+    auto body = base + sizeof(*hdr) + common_padded;
+    prefixes = reinterpret_cast<const uint64_t*>(body);
+    block_offsets = reinterpret_cast<const uint64_t*>(body + prefixes_size);
+    data = body + prefixes_size + offsets_size;
+    nstages = hdr->nstages;
+    std::copy(hdr->stage_size_steps, hdr->stage_size_steps + nstages, stage_size_steps);
+    compute_stage_ends(hdr->nblocks, stage_ends, stage_size_steps, nstages);
+    filter = open_bloom_filter(fname);
+}
+
+std::string_view StringSortIndex::first_key(size_t block) const {
+    auto pos = data + block_offsets[block];
+    get_varint(pos);
+    auto size = get_varint(pos);
+    return std::string_view(reinterpret_cast<const char*>(pos), size);
+}
+
+size_t StringSortIndex::count_blocks(std::string_view key, bool inclusive) const {
+    // Every first key starts with common_prefix, a key that differs in it is below or above all of them
+    auto cmp = key.substr(0, common_prefix.size()).compare(common_prefix);
+    if (cmp != 0) {
+        return cmp < 0 ? 0 : hdr->nblocks;
+    }
+    auto prefix = string_key_prefix(key.substr(common_prefix.size()));
+    // Blocks with a smaller prefix start below key, a larger one above; equal prefixes
+    // are a tie the full first keys decide
+    auto lo = find_idx_count(
+        stage_ends, stage_size_steps, nstages,
+        [&](size_t tree_idx) { return prefixes[tree_idx] < prefix; },
+        [&](size_t begin, size_t end) { return idx_count_less(prefixes + begin, end - begin, prefix); }
+    );
+    auto hi = find_idx_count(
+        stage_ends, stage_size_steps, nstages,
+        [&](size_t tree_idx) { return prefixes[tree_idx] <= prefix; },
+        [&](size_t begin, size_t end) { return idx_count_less_equal(prefixes + begin, end - begin, prefix); }
+    );
+    return idx_partition_point(lo, hi, [&](size_t block) {
+        auto first = first_key(block);
+        return inclusive ? first <= key : first < key;
+    });
+}
+
+size_t StringSortIndex::count_in_block(size_t block, std::string_view key, bool inclusive) const {
+    auto block_begin = block * hdr->block_keys;
+    StringBlockCursor cursor(data + block_offsets[block], std::min<size_t>(hdr->block_keys, hdr->nkeys - block_begin));
+    size_t count = 0;
+    while (cursor.next()) {
+        auto current = cursor.current();
+        if (inclusive ? key < current : key <= current) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+size_t StringSortIndex::rank(std::string_view key, bool inclusive) const {
+    auto nblocks = count_blocks(key, inclusive);
+    if (!nblocks) {
+        return 0;
+    }
+    auto block = nblocks - 1;
+    return block * hdr->block_keys + count_in_block(block, key, inclusive);
+}
+
+size_t StringSortIndex::count(std::string_view key) const {
+    if (filter && !filter->may_contain(BloomKeyHash<std::string_view>()(key))) {
+        return 0;
+    }
+    return upper_bound(key) - lower_bound(key);
+}
+
+std::string StringSortIndex::key_at(size_t idx) const {
+    if (idx >= hdr->nkeys) {
+        throw std::out_of_range("String index position out of range.");
+    }
+    std::string key;
+    for_each(idx, idx + 1, [&](std::string_view current) { key = current; });
+    return key;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "block.h"
+#include "bloom.h"
+#include "idx_sort_static.h"
+
+
+constexpr static int STRING_IDX_MAX_STAGES = 8;
+// Block prefixes per stage step and top stage size of the prefix layout
+constexpr static size_t STRING_IDX_STEP = 16;
+constexpr static size_t STRING_IDX_TOP_ITEMS = 4096;
+
+typedef struct StringIndexHeader {
+    uint64_t magic;
+    uint64_t nkeys;
+    uint64_t nblocks;
+    uint32_t block_keys;
+    int32_t nstages;
+    uint64_t stage_size_steps[STRING_IDX_MAX_STAGES];
+    uint64_t common_prefix_size;
+    uint64_t data_size;
+} StringIndexHeader;
+
+// Normalized key prefix: first 8 bytes big endian, zero padded - integer order is memcmp order
+uint64_t string_key_prefix(std::string_view key);
+
+// Bytes all of the sorted keys start with
+size_t string_common_prefix_size(std::span<const std::string_view> sorted_keys);
+
+// Writes a static index over keys (any order, duplicates allowed) to fname, returns the key count.
+// Keys are ordered bytewise (memcmp, shorter first on a common prefix). With filter_bits_per_key
+// a bloom filter of the keys goes to `<fname>.bloom` (0 - no filter).
+size_t build_string_index(
+    const char *fname, std::vector<std::string_view> keys, unsigned block_keys = 16,
+    unsigned filter_bits_per_key = BLOOM_BITS_PER_KEY
+);
+
+// Static sorted index over variable length byte keys (object ids, peer ids).
+// Sorted keys are front coded in blocks of block_keys: the first key of a block is stored
+// whole, the others as (shared prefix length, suffix). The normalized prefix of every block's
+// first key goes to a multi-stage layout searched with the SIMD uint64 path; full keys are
+// only compared on prefix ties and inside the single block that holds the answer.
+// The prefix is taken after the bytes shared by all keys (a common path like `objects/`),
+// otherwise such keys would all tie and every lookup would compare full keys.
+// count() asks the bloom filter first when the index has one.
+// File: header | common prefix (8 byte padded) | block prefixes (stage layout) | block offsets | block data
+class StringSortIndex {
+    BlockStorage<byte> storage;
+    const StringIndexHeader *hdr;
+    std::string_view common_prefix;
+    const uint64_t *prefixes;
+    const uint64_t *block_offsets;  // nblocks + 1, into data
+    const byte *data;
+    std::unique_ptr<BloomFilter> filter;
+    size_t stage_size_steps[STRING_IDX_MAX_STAGES];
+    size_t stage_ends[STRING_IDX_MAX_STAGES];
+    int nstages;
+
+    std::string_view first_key(size_t block) const;
+    // Blocks whose first key is < key, or <= key when inclusive
+    size_t count_blocks(std::string_view key, bool inclusive) const;
+    // Keys of the block that are < key, or <= key when inclusive
+    size_t count_in_block(size_t block, std::string_view key, bool inclusive) const;
+    size_t rank(std::string_view key, bool inclusive) const;
+
+    public:
+    StringSortIndex(const char *fname);
+
+    size_t size() const {
+        return hdr->nkeys;
+    }
+
+    bool has_filter() const {
+        return filter != nullptr;
+    }
+
+    // Keys ordered before key
+    size_t lower_bound(std::string_view key) const {
+        return rank(key, false);
+    }
+
+    // Keys not ordered after key
+    size_t upper_bound(std::string_view key) const {
+        return rank(key, true);
+    }
+
+    // [start, end) positions of the keys in [start_key, end_key], like find_key_range
+    std::tuple<size_t, size_t> find_range(std::string_view start_key, std::string_view end_key) const {
+        return std::make_tuple(lower_bound(start_key), upper_bound(end_key));
+    }
+
+    // Copies of key in the index
+    size_t count(std::string_view key) const;
+
+    // Key at sorted position idx
+    std::string key_at(size_t idx) const;
+
+    // Keys at sorted positions [first, last) in order; the view is valid during the call
+    template<typename Fvisit>
+    void for_each(size_t first, size_t last, Fvisit visit) const;
+};
+
+// Front coded block reader, keys come out in order
+class StringBlockCursor {
+    const byte *pos;
+    size_t left;
+    std::string key;
+
+    public:
+    StringBlockCursor(const byte *block, size_t nkeys) : pos(block), left(nkeys) {}
+
+    // False past the last key of the block
+    bool next();
+
+    std::string_view current() const {
+        return key;
+    }
+};
+
+template<typename Fvisit>
+void StringSortIndex::for_each(size_t first, size_t last, Fvisit visit) const {
+    last = std::min<size_t>(last, hdr->nkeys);
+    for (auto block = first / hdr->block_keys; first < last; block++) {
+        auto block_begin = block * hdr->block_keys;
+        auto nkeys = std::min<size_t>(hdr->block_keys, hdr->nkeys - block_begin);
+        StringBlockCursor cursor(data + block_offsets[block], nkeys);
+        for (auto idx = block_begin; idx < last && cursor.next(); idx++) {
+            if (idx >= first) {
+                visit(cursor.current());
+            }
+        }
+        first = block_begin + nkeys;
+    }
+}
@@ -0,0 +1,162 @@
+#include "journal.h"
+#include "crc32c.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+
+constexpr static uint32_t JOURNAL_MAGIC = 0x4c4e524a;  // "JRNL"
+
+static uint32_t record_crc(const JournalRecordHeader &hdr, const byte *payload) {
+    constexpr auto fields = offsetof(JournalRecordHeader, lsn);
+    auto crc = crc32c(0, reinterpret_cast<const byte*>(&hdr) + fields, sizeof(hdr) - fields);
+    return crc32c(crc, payload, hdr.len);
+}
+
+Journal::Journal(const char *fname, Tapply apply, Tsync sync_data, size_t checkpoint_bytes)
+    : fname(fname), apply(std::move(apply)), sync_data(std::move(sync_data)),
+      checkpoint_bytes(checkpoint_bytes) {
+    size_t size;
+    fd = open(fname, get_open_flags(false, true) | O_APPEND, S_IRUSR | S_IWUSR);
+    if (!fd.valid()) {
+        throw_sys_error("open journal `" + this->fname + "`");
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        throw_sys_error("fstat journal `" + this->fname + "`");
+    }
+    size = st.st_size;
+
+    // Recovery - replay the valid prefix, a torn tail is simply dropped
+    if (size) {
+        std::vector<byte> log(size);
+        if (pread(fd, log.data(), size, 0) != (ssize_t)size) {
+            throw_sys_error("read journal `" + this->fname + "`");
+        }
+        next_lsn = apply_records(log.data(), size) + 1;
+        checkpoint_unsafe();
+    }
+}
+
+uint64_t Journal::apply_records(const byte *data, size_t size) {
+    uint64_t last_lsn = 0;
+    size_t pos = 0;
+    while (pos + sizeof(JournalRecordHeader) <= size) {
+        JournalRecordHeader hdr;
+        memcpy(&hdr, data + pos, sizeof(hdr));
+        auto payload = data + pos + sizeof(hdr);
+        if (
+            hdr.magic != JOURNAL_MAGIC || hdr.len > size - pos - sizeof(hdr)
+            || record_crc(hdr, payload) != hdr.crc
+        ) {
+            break;
+        }
+        apply(hdr.offset, payload, hdr.len);
+        last_lsn = hdr.lsn;
+        pos += sizeof(hdr) + hdr.len;
+    }
+    return last_lsn;
+}
+
+void Journal::check_broken() {
+    if (broken) {
+        throw std::runtime_error("Journal `" + fname + "` failed earlier, refusing further writes.");
+    }
+}
+
+uint64_t Journal::append(uint64_t offset, const void *data, size_t len) {
+    std::lock_guard<std::mutex> guard(lock);
+    check_broken();
+    JournalRecordHeader hdr;
+    hdr.magic = JOURNAL_MAGIC;
+    hdr.lsn = next_lsn++;
+    hdr.offset = offset;
+    hdr.len = len;
+    hdr.crc = record_crc(hdr, static_cast<const byte*>(data));
+
+    auto hdr_bytes = reinterpret_cast<const byte*>(&hdr);
+    buffer.insert(buffer.end(), hdr_bytes, hdr_bytes + sizeof(hdr));
+    buffer.insert(buffer.end(), static_cast<const byte*>(data), static_cast<const byte*>(data) + len);
+    return hdr.lsn;
+}
+
+void Journal::commit(uint64_t lsn) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (lsn >= next_lsn) {
+        // Would wait for a record nobody appended, flushing empty groups forever
+        throw std::invalid_argument(
+            "Commit of lsn " + std::to_string(lsn) + " past the last appended record of journal `" + fname + "`."
+        );
+    }
+    while (durable_lsn < lsn) {
+        check_broken();
+        if (flushing) {
+            cv.wait(guard);
+            continue;
+        }
+
+        // Leader - take everything buffered, including records of the waiting followers
+        flushing = true;
+        std::vector<byte> batch;
+        batch.swap(buffer);
+        auto batch_lsn = next_lsn - 1;
+        guard.unlock();
+
+        // log_size is only touched by the flushing thread
+        try {
+            if (write(fd, batch.data(), batch.size()) != (ssize_t)batch.size()) {
+                throw_sys_error("append journal `" + fname + "`");
+            }
+            if (fdatasync(fd) == -1) {
+                throw_sys_error("fdatasync journal `" + fname + "`");
+            }
+            apply_records(batch.data(), batch.size());
+            log_size += batch.size();
+            if (log_size >= checkpoint_bytes) {
+                checkpoint_unsafe();
+            }
+        } catch (...) {
+            // Durability of this group is unknown, so nothing after it may be acknowledged either
+            guard.lock();
+            broken = true;
+            flushing = false;
+            cv.notify_all();
+            throw;
+        }
+
+        guard.lock();
+        durable_lsn = batch_lsn;
+        flushing = false;
+        cv.notify_all();
+    }
+}
+
+void Journal::commit() {
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        lsn = next_lsn - 1;
+    }
+    commit(lsn);
+}
+
+void Journal::checkpoint_unsafe() {
+    sync_data();
+    if (ftruncate(fd, 0) == -1) {
+        throw_sys_error("truncate journal `" + fname + "`");
+    }
+    if (fdatasync(fd) == -1) {
+        throw_sys_error("fdatasync journal `" + fname + "`");
+    }
+    log_size = 0;
+}
+
+void Journal::checkpoint() {
+    std::unique_lock<std::mutex> guard(lock);
+    cv.wait(guard, [this] { return !flushing; });
+    check_broken();
+    // Records still in the buffer are not in the log file yet, truncating keeps them
+    checkpoint_unsafe();
+}
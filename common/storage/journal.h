@@ -0,0 +1,109 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "block.h"
+
+
+typedef struct JournalRecordHeader {
+    uint32_t magic;
+    uint32_t crc;     // crc32c of the fields below + payload
+    uint64_t lsn;
+    uint64_t offset;  // byte offset in the data file
+    uint64_t len;
+} JournalRecordHeader;
+
+// Redo log with group commit.
+// Records are buffered by append(); the first committer to arrive becomes the leader,
+// writes everything buffered so far with a single fdatasync and applies it through
+// `apply`, while later committers wait for the next group. Only durable records are
+// applied, so the data file never holds changes the log cannot replay.
+class Journal {
+    using Tapply = std::function<void(uint64_t offset, const byte *data, size_t len)>;
+    using Tsync = std::function<void()>;
+
+    std::string fname;
+    unique_fd fd;
+    Tapply apply;
+    Tsync sync_data;
+    size_t checkpoint_bytes;
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<byte> buffer;
+    uint64_t next_lsn = 1;
+    uint64_t durable_lsn = 0;
+    size_t log_size = 0;
+    bool flushing = false;
+    bool broken = false;
+
+    // Returns the lsn of the last valid record
+    uint64_t apply_records(const byte *data, size_t size);
+    void check_broken();
+    void checkpoint_unsafe();
+
+    public:
+    // Replays the durable prefix of an existing log (recovery), then checkpoints it away.
+    // sync_data must make everything applied so far durable in the data file.
+    Journal(const char *fname, Tapply apply, Tsync sync_data, size_t checkpoint_bytes = 64 << 20);
+
+    uint64_t append(uint64_t offset, const void *data, size_t len);
+    // Blocks until lsn is durable and applied; lsn must have been returned by append()
+    void commit(uint64_t lsn);
+    // Commit everything appended so far
+    void commit();
+    // Sync the data file and truncate the log
+    void checkpoint();
+};
+
+// BlockStorage whose writes go through the redo log; readers see a write once it is committed.
+template<class T = byte>
+class JournaledBlockStorage {
+    BlockStorage<T> storage;
+    Journal journal;
+
+    public:
+    JournaledBlockStorage(const char *fname, size_t n, size_t checkpoint_bytes = 64 << 20)
+        : storage(fname, false, n),
+          journal(
+              (std::string(fname) + ".wal").c_str(),
+              [this](uint64_t offset, const byte *data, size_t len) {
+                  storage.write(offset / sizeof(T), reinterpret_cast<const T*>(data), len / sizeof(T));
+              },
+              [this]() { storage.sync(); },
+              checkpoint_bytes
+          ) {}
+
+    size_t size() const {
+        return storage.size();
+    }
+
+    size_t read(size_t offset, T *out_data, size_t data_count) {
+        return storage.read(offset, out_data, data_count);
+    }
+
+    // Logs the write and returns its lsn (0 when out of range); visible after commit(lsn)
+    uint64_t write(size_t offset, const T *in_data, size_t data_count) {
+        data_count = clamp_data_count(offset, data_count, storage.size());
+        if (data_count == 0) {
+            return 0;
+        }
+        return journal.append(offset * sizeof(T), in_data, data_count * sizeof(T));
+    }
+
+    void commit(uint64_t lsn) {
+        journal.commit(lsn);
+    }
+
+    void commit() {
+        journal.commit();
+    }
+
+    void checkpoint() {
+        journal.checkpoint();
+    }
+};
@@ -0,0 +1,234 @@
+#include "uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+static int io_uring_setup(unsigned entries, io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void *mmap_ring(int fd, size_t size, off_t offset, const char *descr) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (ptr == MAP_FAILED) {
+        throw_sys_error(std::string("mmap io_uring ") + descr);
+    }
+    return ptr;
+}
+
+UringEngine::UringEngine(unsigned entries, unsigned max_files) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = io_uring_setup(entries, &params);
+    if (!ring_fd.valid()) {
+        throw_sys_error("setup io_uring");
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+    sq_ring = mmap_ring(ring_fd, sq_ring_size, IORING_OFF_SQ_RING, "sq ring");
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap_ring(ring_fd, cq_ring_size, IORING_OFF_CQ_RING, "cq ring");
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap_ring(ring_fd, sqes_size, IORING_OFF_SQES, "sqes"));
+
+    auto sq_base = static_cast<byte_t*>(sq_ring);
+    sq_head = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+    sq_entries = params.sq_entries;
+
+    auto cq_base = static_cast<byte_t*>(cq_ring);
+    cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq_base + params.cq_off.cqes);
+
+    // Sparse fixed file table - slots are filled in by add_file()
+    if (max_files) {
+        files.assign(max_files, -1);
+        if (io_uring_register(ring_fd, IORING_REGISTER_FILES, files.data(), max_files) == -1) {
+            throw_sys_error("register io_uring file table");
+        }
+    }
+
+    completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!completion_fd.valid()) {
+        throw_sys_error("create io_uring completion eventfd");
+    }
+    int efd = completion_fd;
+    if (io_uring_register(ring_fd, IORING_REGISTER_EVENTFD, &efd, 1) == -1) {
+        throw_sys_error("register io_uring completion eventfd");
+    }
+}
+
+int UringEngine::add_file(int fd) {
+    for (size_t it = 0; it < files.size(); it++) {
+        if (files[it] == -1) {
+            io_uring_files_update update;
+            memset(&update, 0, sizeof(update));
+            update.offset = it;
+            update.fds = reinterpret_cast<uint64_t>(&fd);
+            if (io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == -1) {
+                throw_sys_error("add io_uring fixed file");
+            }
+            files[it] = fd;
+            return it;
+        }
+    }
+    throw std::runtime_error("io_uring fixed file table is full");
+}
+
+void UringEngine::remove_file(int file_idx) {
+    if (file_idx < 0 || file_idx >= (int)files.size() || files[file_idx] == -1) {
+        return;
+    }
+    int fd = -1;
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = file_idx;
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+    if (io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == -1) {
+        show_sys_error("remove io_uring fixed file");
+    }
+    files[file_idx] = -1;
+}
+
+void UringEngine::register_buffers(const iovec *buffers, unsigned count) {
+    unregister_buffers();
+    if (io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, buffers, count) == -1) {
+        throw_sys_error("register io_uring buffers");
+    }
+}
+
+void UringEngine::unregister_buffers() {
+    if (io_uring_register(ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0) == -1 && errno != ENXIO) {
+        show_sys_error("unregister io_uring buffers");
+    }
+}
+
+io_uring_sqe *UringEngine::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail + queued;
+    if (tail - head >= sq_entries) {
+        return NULL;
+    }
+    unsigned idx = tail & *sq_mask;
+    sq_array[idx] = idx;
+    queued++;
+    auto sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool UringEngine::queue_rw(
+    int op, int file_idx, void *buf, size_t len,
+    uint64_t offset, uint64_t tag, int buf_idx
+) {
+    auto sqe = get_sqe();
+    if (!sqe) {
+        submit();
+        sqe = get_sqe();
+        if (!sqe) {
+            return false;
+        }
+    }
+    sqe->opcode = op;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = file_idx;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->user_data = tag;
+    if (buf_idx >= 0) {
+        sqe->buf_index = buf_idx;
+    }
+    return true;
+}
+
+bool UringEngine::queue_read(
+    int file_idx, void *buf, size_t len, uint64_t offset, uint64_t tag, int buf_idx
+) {
+    return queue_rw(
+        buf_idx >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ,
+        file_idx, buf, len, offset, tag, buf_idx
+    );
+}
+
+bool UringEngine::queue_write(
+    int file_idx, const void *buf, size_t len, uint64_t offset, uint64_t tag, int buf_idx
+) {
+    return queue_rw(
+        buf_idx >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+        file_idx, const_cast<void*>(buf), len, offset, tag, buf_idx
+    );
+}
+
+unsigned UringEngine::submit(unsigned wait_nr) {
+    if (queued) {
+        // Publish sqes before moving the tail
+        __atomic_store_n(sq_tail, *sq_tail + queued, __ATOMIC_RELEASE);
+        inflight += queued;
+        queued = 0;
+    }
+    // Entries the kernel did not consume on a previous call are still in the ring
+    unsigned to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (!to_submit && !wait_nr) {
+        return 0;
+    }
+
+    int ret;
+    do {
+        ret = io_uring_enter(ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        throw_sys_error("submit io_uring entries");
+    }
+    return ret;
+}
+
+void UringEngine::reap(unsigned count) {
+    inflight = count < inflight ? inflight - count : 0;
+}
+
+void UringEngine::clear_event() {
+    uint64_t value;
+    if (read(completion_fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        show_sys_error("read io_uring completion eventfd");
+    }
+}
+
+UringEngine::~UringEngine() {
+    if (sqes) {
+        munmap(sqes, sqes_size);
+    }
+    if (cq_ring && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring) {
+        munmap(sq_ring, sq_ring_size);
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <utils/unique_fd.h>
+
+
+// Batched async file I/O over a raw io_uring instance (no liburing dependency).
+// Not thread safe - one engine per polling thread.
+// Completions signal `event_fd()`, so the ring can be watched by `PollEngine`
+// next to the gRPC endpoints instead of blocking a CQ thread on page faults.
+class UringEngine {
+    unique_fd ring_fd;
+    unique_fd completion_fd;
+
+    void *sq_ring = NULL;
+    size_t sq_ring_size = 0;
+    void *cq_ring = NULL;
+    size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = NULL;
+    size_t sqes_size = 0;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+    unsigned sq_entries;
+
+    unsigned queued = 0;     // sqes written, but not handed to the kernel yet
+    size_t inflight = 0;     // submitted, completion not reaped yet
+
+    std::vector<int> files;  // fixed file table, -1 = free slot
+
+    io_uring_sqe *get_sqe();
+    bool queue_rw(
+        int op, int file_idx, void *buf, size_t len,
+        uint64_t offset, uint64_t tag, int buf_idx
+    );
+    void reap(unsigned count);
+
+    public:
+    UringEngine(unsigned entries = 256, unsigned max_files = 64);
+    UringEngine(const UringEngine&) = delete;
+    UringEngine& operator=(const UringEngine&) = delete;
+
+    // Fixed file slot for fd; io is issued with IOSQE_FIXED_FILE on it
+    int add_file(int fd);
+    void remove_file(int file_idx);
+
+    // Registered buffers, addressed by index in queue_read/queue_write (replaces previous set)
+    void register_buffers(const iovec *buffers, unsigned count);
+    void unregister_buffers();
+
+    // buf_idx >= 0 -> buf must lie inside registered buffer buf_idx (READ_FIXED/WRITE_FIXED)
+    // Returns false when the SQ is full even after flushing pending entries.
+    bool queue_read(
+        int file_idx, void *buf, size_t len, uint64_t offset, uint64_t tag, int buf_idx = -1
+    );
+    bool queue_write(
+        int file_idx, const void *buf, size_t len, uint64_t offset, uint64_t tag, int buf_idx = -1
+    );
+
+    // Hand all queued sqes to the kernel in one syscall, optionally waiting for wait_nr completions
+    unsigned submit(unsigned wait_nr = 0);
+
+    // callback(tag, res) for every posted completion; res is bytes transferred or -errno.
+    // Short transfers are possible and left to the caller.
+    template<typename Fcallback>
+    unsigned poll_completions(Fcallback &&callback) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        while (head != tail) {
+            auto &cqe = cqes[head & *cq_mask];
+            callback(cqe.user_data, cqe.res);
+            head++;
+            count++;
+        }
+        if (count) {
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            reap(count);
+        }
+        return count;
+    }
+
+    int event_fd() const {
+        return completion_fd;
+    }
+    // Drain event_fd() before polling completions when driven from epoll
+    void clear_event();
+
+    size_t pending() const {
+        return inflight + queued;
+    }
+
+    ~UringEngine();
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// Epoch based reclamation for structures with lock-free readers.
+// Readers hold a Guard from enter() while they may touch shared memory; writers
+// unlink an object, retire() it, and collect() later runs the free callback once
+// every reader that might still see the object has left.
+class EpochManager {
+    constexpr static uint64_t IDLE = 0;
+
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch = IDLE;
+    };
+
+    std::atomic<uint64_t> global_epoch = 1;
+    std::unique_ptr<ReaderSlot[]> slots;
+    size_t nslots;
+
+    std::mutex retire_lock;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+
+    public:
+    class Guard {
+        std::atomic<uint64_t> *slot;
+
+        public:
+        Guard(std::atomic<uint64_t> *slot) : slot(slot) {}
+        Guard(Guard &&other) : slot(other.slot) {
+            other.slot = NULL;
+        }
+        Guard(const Guard&) = delete;
+        Guard &operator=(const Guard&) = delete;
+
+        ~Guard() {
+            if (slot) {
+                slot->store(IDLE, std::memory_order_release);
+            }
+        }
+    };
+
+    // nslots bounds the number of readers inside at once, more have to wait
+    EpochManager(size_t nslots = 128) : slots(new ReaderSlot[nslots]), nslots(nslots) {}
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager &operator=(const EpochManager&) = delete;
+
+    Guard enter() {
+        auto start = std::hash<std::thread::id>()(std::this_thread::get_id());
+        for (;;) {
+            for (size_t it = 0; it < nslots; it++) {
+                auto &slot = slots[(start + it) % nslots].epoch;
+                auto idle = IDLE;
+                // seq_cst: a collect() that does not see this slot finished unlinking before we read anything
+                if (slot.compare_exchange_strong(idle, global_epoch.load())) {
+                    return Guard(&slot);
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // free_fn runs on the thread calling collect(), never concurrently with itself
+    void retire(std::function<void()> free_fn) {
+        std::lock_guard<std::mutex> guard(retire_lock);
+        retired.emplace_back(global_epoch.load(), std::move(free_fn));
+    }
+
+    size_t pending() {
+        std::lock_guard<std::mutex> guard(retire_lock);
+        return retired.size();
+    }
+
+    // Frees everything retired before the oldest active reader entered;
+    // does nothing while fewer than min_pending objects wait
+    void collect(size_t min_pending = 0) {
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> guard(retire_lock);
+            if (retired.empty() || retired.size() < min_pending) {
+                return;
+            }
+            auto oldest = global_epoch.fetch_add(1) + 1;
+            for (size_t it = 0; it < nslots; it++) {
+                auto epoch = slots[it].epoch.load();
+                if (epoch != IDLE && epoch < oldest) {
+                    oldest = epoch;
+                }
+            }
+            // A reader of epoch e may have seen objects retired during e
+            size_t kept = 0;
+            for (size_t it = 0; it < retired.size(); it++) {
+                if (retired[it].first < oldest) {
+                    ready.emplace_back(std::move(retired[it].second));
+                } else {
+                    if (kept != it) {
+                        retired[kept] = std::move(retired[it]);
+                    }
+                    kept++;
+                }
+            }
+            retired.resize(kept);
+        }
+        for (auto &free_fn : ready) {
+            free_fn();
+        }
+    }
+};
@@ -0,0 +1,85 @@
+#include "numa.h"
+#include "err.h"
+
+#include <cstdio>
+#include <string>
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+// Parses sysfs cpu/node lists like "0-15,32-47"
+static std::vector<int> read_id_list(const std::string &path) {
+    std::vector<int> ids;
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) {
+        return ids;
+    }
+    int start, end;
+    char sep;
+    while (fscanf(f, "%d", &start) == 1) {
+        end = start;
+        sep = fgetc(f);
+        if (sep == '-') {
+            if (fscanf(f, "%d", &end) != 1) {
+                break;
+            }
+            sep = fgetc(f);
+        }
+        for (int id = start; id <= end; id++) {
+            ids.push_back(id);
+        }
+        if (sep != ',') {
+            break;
+        }
+    }
+    fclose(f);
+    return ids;
+}
+
+int numa_node_count() {
+    static const int count = [] {
+        auto nodes = read_id_list("/sys/devices/system/node/online");
+        return nodes.empty() ? 1 : nodes.back() + 1;
+    }();
+    return count;
+}
+
+int numa_current_node() {
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == -1) {
+        return 0;
+    }
+    return node;
+}
+
+std::vector<int> numa_node_cpus(int node) {
+    auto cpus = read_id_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (cpus.empty() && node == 0) {
+        // No NUMA in sysfs - all cpus belong to node 0
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+static void set_thread_cpus(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        throw_sys_error("set thread cpu affinity");
+    }
+}
+
+void pin_thread_to_node(int node) {
+    set_thread_cpus(numa_node_cpus(node));
+}
+
+void pin_thread_to_cpu(int cpu) {
+    set_thread_cpus({cpu});
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+
+// NUMA topology from sysfs; machines without NUMA report a single node 0
+int numa_node_count();
+int numa_current_node();
+std::vector<int> numa_node_cpus(int node);
+
+// Restrict the calling thread to the cpus of one node (or a single cpu)
+void pin_thread_to_node(int node);
+void pin_thread_to_cpu(int cpu);
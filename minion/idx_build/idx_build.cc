@@ -0,0 +1,91 @@
+#include <storage/idx_sort_build.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+
+// Builds a static sorted index from a raw column file:
+//   idx_build [-t threads] [-f filter bits per key] <i32|i64|u64|f32|f64> <column file> <index file> [step ...]
+// Each step adds a stage above the previous one, holding every step+1-th key.
+// The bloom filter for point lookups goes to `<index file>.bloom`, -f 0 skips it.
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t threads] [-f filter bits per key] <i32|i64|u64|f32|f64> <column file> <index file> [step ...]\n", prog);
+}
+
+template<class T>
+static size_t build(
+    const char *column_fname, const char *index_fname, const std::vector<size_t> &steps,
+    unsigned nthreads, unsigned filter_bits
+) {
+    return build_sort_index_file<T>(column_fname, index_fname, steps.data(), steps.size(), nthreads, filter_bits);
+}
+
+int main(int argc, char **argv) {
+    unsigned nthreads = 0;
+    unsigned filter_bits = BLOOM_BITS_PER_KEY;
+    std::vector<const char*> args;
+    for (int it = 1; it < argc; it++) {
+        if (!strcmp(argv[it], "-t") && it + 1 < argc) {
+            nthreads = atoi(argv[++it]);
+        } else if (!strcmp(argv[it], "-f") && it + 1 < argc) {
+            filter_bits = atoi(argv[++it]);
+        } else {
+            args.push_back(argv[it]);
+        }
+    }
+    if (args.size() < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string type = args[0];
+    auto column_fname = args[1];
+    auto index_fname = args[2];
+    // Steps between stages, the last stage has none
+    std::vector<size_t> steps;
+    for (size_t it = 3; it < args.size(); it++) {
+        steps.push_back(strtoull(args[it], NULL, 10));
+    }
+    steps.push_back(0);
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+        size_t n;
+        if (type == "i32") {
+            n = build<int32_t>(column_fname, index_fname, steps, nthreads, filter_bits);
+        } else if (type == "i64") {
+            n = build<int64_t>(column_fname, index_fname, steps, nthreads, filter_bits);
+        } else if (type == "u64") {
+            n = build<uint64_t>(column_fname, index_fname, steps, nthreads, filter_bits);
+        } else if (type == "f32") {
+            n = build<float>(column_fname, index_fname, steps, nthreads, filter_bits);
+        } else if (type == "f64") {
+            n = build<double>(column_fname, index_fname, steps, nthreads, filter_bits);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<size_t> stage_ends(steps.size());
+        compute_stage_ends(n, stage_ends.data(), steps.data(), steps.size());
+        printf(
+            "keys: %zu, threads: %u, filter bits per key: %u, time: %.3fs\nstage ends:",
+            n, idx_build_threads(nthreads), filter_bits, elapsed
+        );
+        for (auto end : stage_ends) {
+            printf(" %zu", end);
+        }
+        printf("\n");
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
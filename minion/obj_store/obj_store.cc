@@ -1,10 +1,12 @@
 #include <utils/unique_fd.h>
 #include <grpc/callback.h>
 #include <crypto/sgn.h>
+#include <storage/block.h>
 
 #include <algorithm>
 #include <memory>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 
@@ -29,6 +31,18 @@ bool seek_ok(int fd, int64_t offset) {
     return true;
 }
 
+// Same offset convention as seek_ok, resolved against a known object size.
+bool obj_offset(size_t size, int64_t offset, size_t *start) {
+    if (offset < 0) {
+        offset += static_cast<int64_t>(size) + 1;
+        if (offset < 0) {
+            return false;
+        }
+    }
+    *start = static_cast<size_t>(offset);
+    return true;
+}
+
 static const char *hash_digest_name(obj_store::HashType t) {
     switch (t) {
         case obj_store::SHA256:
@@ -97,36 +111,284 @@ class ReadHandler : public GRPCBasicHandler<
     }
 
     void handle_request() override {
-        auto & id = request.id();
+        try {
+            // TODO: auth
+            // TODO: object auth paths
+            // TODO: report quota
+            auto path = obj_path(request.id());
+            BlockStorage<byte> obj(path.c_str());
+
+            size_t start;
+            if (!obj_offset(obj.size(), request.offset(), &start)) {
+                response.set_result(resource::OperationResult::FAILED);
+                return;
+            }
+
+            auto to_read = request.data_len();
+            if (to_read > 0) {
+                // Copied once, straight from the mapping - no read() into a staging buffer
+                auto data = obj.view(start, to_read);
+                if (data.empty()) {
+                    response.set_result(resource::OperationResult::FAILED);
+                    return;
+                }
+                response.set_content(
+                    std::string(reinterpret_cast<const char *>(data.data()), data.size()));
+            }
+
+            response.set_result(resource::OperationResult::OK);
+        } catch (...) {
+            response.set_result(resource::OperationResult::FAILED);
+        }
+    }
+};
+
+// Stream chunk size: bounds per stream memory to about two chunks, stays below the 4 MiB
+// default gRPC message limit
+constexpr static size_t OBJ_STREAM_CHUNK = 1 << 20;
 
+enum class StreamOp { kRead, kWrite, kFinish };
+
+// Whole range, false on a short read (object truncated meanwhile) or error
+static bool pread_full(int fd, char *buf, size_t len, size_t offset) {
+    while (len) {
+        auto n = pread(fd, buf, len, static_cast<off_t>(offset));
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool pwrite_full(int fd, const char *buf, size_t len, size_t offset) {
+    while (len) {
+        auto n = pwrite(fd, buf, len, static_cast<off_t>(offset));
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// One Write in flight at a time, so the client receive window paces the stream. gRPC serializes
+// the message inside Write, so the next chunk is read into `response` while the previous one
+// is still being sent.
+class ReadStreamHandler : public GRPCStreamHandler<
+    ReadStreamHandler,
+    obj_store::ObjStore::AsyncService,
+    obj_store::ReadRequest,
+    obj_store::ContentResult,
+    grpc::ServerAsyncWriter<obj_store::ContentResult>
+> {
+    StreamOp pending_ = StreamOp::kWrite;
+
+    unique_fd fd_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    bool read_failed_ = false;
+
+    public:
+    explicit ReadStreamHandler(obj_store::ObjStore::AsyncService* async_service)
+        : GRPCStreamHandler(async_service) {}
+
+    ReadStreamHandler(const ReadStreamHandler& other)
+        : GRPCStreamHandler(other.service) {}
+
+    void bind(grpc::ServerCompletionQueue* cq) override {
+        service->RequestReadStream(&ctx, &request, &stream, cq, cq, this);
+    }
+
+    void on_stream_rpc_connected(grpc::ServerCompletionQueue* cq) override {
+        (void)cq;
         // TODO: auth
         // TODO: object auth paths
         // TODO: report quota
-        auto path = obj_path(id);
-        unique_fd fd = open(path.c_str(), O_RDONLY);
-        if (!fd.valid()) {
-            response.set_result(resource::OperationResult::FAILED);
+        if (!open_object() || !read_chunk()) {
+            finish_failed();
             return;
         }
+        send_chunk();
+    }
 
-        if (!seek_ok(fd, request.offset())) {
-            response.set_result(resource::OperationResult::FAILED);
+    void process(grpc::ServerCompletionQueue* cq, bool running) override {
+        if (stream_connect_phase_ != StreamConnectPhase::kStreaming) {
+            handle_stream_connect(cq, running);
             return;
         }
 
-        auto to_read = request.data_len();
-        if (to_read > 0) {
-            std::string data(to_read, '\0');
-            auto read_res = read(fd, data.data(), to_read);
-            if (read_res <= 0) {
-                response.set_result(resource::OperationResult::FAILED);
-                return;
-            }
-            data.resize(read_res);
-            response.set_content(data);
+        switch (pending_) {
+            case StreamOp::kWrite:
+                if (!running) {
+                    // Client went away
+                    pending_ = StreamOp::kFinish;
+                    finish(grpc::Status::CANCELLED);
+                } else if (read_failed_) {
+                    finish_failed();
+                } else {
+                    send_chunk();
+                }
+                break;
+            case StreamOp::kRead:
+            case StreamOp::kFinish:
+                grpc_defer_handler_destroy(std::unique_ptr<GRPCHandler>(self_.release()));
+                break;
+        }
+    }
+
+    private:
+    bool open_object() {
+        auto path = obj_path(request.id());
+        fd_ = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (!fd_.valid() || fstat(fd_, &st)) {
+            return false;
         }
 
+        size_t size = static_cast<size_t>(st.st_size);
+        if (!obj_offset(size, request.offset(), &pos_) || pos_ > size) {
+            return false;
+        }
+        auto data_len = request.data_len();
+        end_ = data_len > 0 ? pos_ + static_cast<size_t>(data_len) : size;
+        if (end_ > size) {
+            return false;
+        }
+        posix_fadvise(fd_, static_cast<off_t>(pos_), static_cast<off_t>(end_ - pos_), POSIX_FADV_SEQUENTIAL);
+        return true;
+    }
+
+    // Next chunk into `response`, the content buffer is reused between chunks
+    bool read_chunk() {
+        auto n = std::min(OBJ_STREAM_CHUNK, end_ - pos_);
+        auto content = response.mutable_content();
+        content->resize(n);
+        if (!pread_full(fd_, content->data(), n, pos_)) {
+            return false;
+        }
+        pos_ += n;
         response.set_result(resource::OperationResult::OK);
+        return true;
+    }
+
+    void send_chunk() {
+        if (pos_ >= end_) {
+            pending_ = StreamOp::kFinish;
+            stream.WriteAndFinish(response, grpc::WriteOptions(), grpc::Status::OK, this);
+            return;
+        }
+        pending_ = StreamOp::kWrite;
+        stream.Write(response, this);
+        read_failed_ = !read_chunk();
+    }
+
+    void finish_failed() {
+        response.clear_content();
+        response.set_result(resource::OperationResult::FAILED);
+        pending_ = StreamOp::kFinish;
+        stream.WriteAndFinish(response, grpc::WriteOptions(), grpc::Status::OK, this);
+    }
+};
+
+// Reads are double buffered: the next message is requested before the current one is
+// written to disk, so receiving overlaps with pwrite. After a failure the rest of the
+// stream is drained without writing, the result is sent once the client is done.
+class WriteStreamHandler : public GRPCStreamHandler<
+    WriteStreamHandler,
+    obj_store::ObjStore::AsyncService,
+    obj_store::WriteRequest,
+    obj_store::Result,
+    grpc::ServerAsyncReader<obj_store::Result, obj_store::WriteRequest>
+> {
+    StreamOp pending_ = StreamOp::kRead;
+
+    obj_store::WriteRequest received_;
+    unique_fd fd_;
+    size_t pos_ = 0;
+    bool started_ = false;
+    bool failed_ = false;
+
+    public:
+    explicit WriteStreamHandler(obj_store::ObjStore::AsyncService* async_service)
+        : GRPCStreamHandler(async_service) {}
+
+    WriteStreamHandler(const WriteStreamHandler& other)
+        : GRPCStreamHandler(other.service) {}
+
+    void bind(grpc::ServerCompletionQueue* cq) override {
+        service->RequestWriteStream(&ctx, &stream, cq, cq, this);
+    }
+
+    void on_stream_rpc_connected(grpc::ServerCompletionQueue* cq) override {
+        (void)cq;
+        pending_ = StreamOp::kRead;
+        read();
+    }
+
+    void process(grpc::ServerCompletionQueue* cq, bool running) override {
+        if (stream_connect_phase_ != StreamConnectPhase::kStreaming) {
+            handle_stream_connect(cq, running);
+            return;
+        }
+
+        switch (pending_) {
+            case StreamOp::kRead:
+                if (!running) {
+                    // Client half-closed, everything is on disk
+                    response.set_result(
+                        started_ && !failed_ ? resource::OperationResult::OK : resource::OperationResult::FAILED);
+                    fd_.reset();
+                    pending_ = StreamOp::kFinish;
+                    stream.Finish(response, grpc::Status::OK, this);
+                    return;
+                }
+                received_.Swap(&request);
+                read();
+                write_chunk();
+                break;
+            case StreamOp::kWrite:
+            case StreamOp::kFinish:
+                grpc_defer_handler_destroy(std::unique_ptr<GRPCHandler>(self_.release()));
+                break;
+        }
+    }
+
+    private:
+    // TODO: error logging
+    bool open_object() {
+        // TODO: auth
+        // TODO: save object auth paths
+        // TODO: report quota
+        auto path = obj_path(received_.id());
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        struct stat st;
+        if (!fd_.valid() || fstat(fd_, &st)) {
+            return false;
+        }
+        return obj_offset(static_cast<size_t>(st.st_size), received_.offset(), &pos_);
+    }
+
+    void write_chunk() {
+        if (!started_) {
+            started_ = true;
+            failed_ = !open_object();
+        }
+        if (failed_) {
+            return;
+        }
+
+        auto & data = received_.data();
+        if (!pwrite_full(fd_, data.data(), data.size(), pos_)) {
+            failed_ = true;
+            fd_.reset();
+            return;
+        }
+        pos_ += data.size();
     }
 };
 
@@ -241,6 +503,8 @@ int main() {
 
     grpc_prime_async_handler(std::make_unique<WriteHandler>(&service), cq.get(), true);
     grpc_prime_async_handler(std::make_unique<ReadHandler>(&service), cq.get(), true);
+    grpc_prime_async_handler(std::make_unique<ReadStreamHandler>(&service), cq.get(), true);
+    grpc_prime_async_handler(std::make_unique<WriteStreamHandler>(&service), cq.get(), true);
     grpc_prime_async_handler(std::make_unique<DeleteHandler>(&service), cq.get(), true);
     grpc_prime_async_handler(std::make_unique<HashHandler>(&service), cq.get(), true);
 